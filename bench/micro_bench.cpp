@@ -0,0 +1,310 @@
+// Microbenchmarks for the engine components, one fixture per component.
+// Each fixture reports the best ns/byte (and TSC cycles/byte on x86) over
+// repeated runs and compares it with the stored baseline:
+//
+//   micro_bench [--filter=substring] [--min-time=seconds]
+//               [--baseline=file] [--write-baseline]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "backtracking_matcher.hpp"
+#include "grep_engine.hpp"
+#include "literal_matcher.hpp"
+#include "token_filter.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_HAS_RDTSC 1
+#endif
+
+#ifndef GREP_BENCH_BASELINE
+#define GREP_BENCH_BASELINE "bench/baseline.txt"
+#endif
+
+namespace
+{
+    // One run processes every byte of the fixture's input once and returns
+    // a value that depends on the work, so it cannot be optimized away.
+    struct Fixture
+    {
+        std::string name;
+        size_t bytes_per_run = 0;
+        std::function<size_t()> run;
+    };
+
+    struct Measurement
+    {
+        double ns_per_byte = 0;
+        double cycles_per_byte = -1; // Negative where no cycle counter is available
+    };
+
+    uint64_t read_cycle_counter()
+    {
+#if defined(BENCH_HAS_RDTSC)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    // Discards everything written to it, so formatting is timed without I/O.
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int character) override { return character; }
+        std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+    };
+
+    // Lines of words drawn from a fixed vocabulary, with digits and
+    // punctuation mixed in like a typical log.
+    std::string make_log_text(size_t size)
+    {
+        static const char *const words[] = {"alpha", "beta", "gamma", "delta", "error", "warning", "info", "request",
+                                            "user_42", "timeout", "connection", "10.0.0.1", "status=200", "retry"};
+        std::mt19937 generator(12345);
+        std::uniform_int_distribution<size_t> pick_word(0, std::size(words) - 1);
+        std::uniform_int_distribution<int> pick_line_length(4, 14);
+        std::string text;
+        while (text.size() < size)
+        {
+            int word_count = pick_line_length(generator);
+            for (int word = 0; word < word_count; ++word)
+            {
+                text += words[pick_word(generator)];
+                text += word + 1 < word_count ? ' ' : '\n';
+            }
+        }
+        return text;
+    }
+
+    Fixture nfa_step_fixture(const std::string &name, const std::string &pattern, const std::string &text)
+    {
+        std::shared_ptr<NFAState> nfa = compile_regex_to_nfa(pattern);
+        return {name, text.size(), [nfa, text]
+                { return run_nfa_simulation(nfa, text); }};
+    }
+
+    Fixture dfa_fixture(const std::string &name, const std::string &pattern, const std::string &text)
+    {
+        std::shared_ptr<NFAState> nfa = compile_regex_to_nfa(pattern);
+        auto dfa = std::make_shared<LazyDFA>(build_lazy_dfa(nfa));
+        return {name, text.size(), [nfa, dfa, &text]
+                { return match_text_with_dfa(*dfa, text).matches.size(); }};
+    }
+
+    std::vector<Fixture> make_fixtures(const std::string &log_text, const std::string &token_filter_path)
+    {
+        std::vector<Fixture> fixtures;
+
+        // process_character_step, one opcode at a time: "X*!" keeps X and a
+        // literal that never matches active over input X accepts throughout.
+        const std::string letters(1 << 12, 'a');
+        const std::string digits(1 << 12, '7');
+        fixtures.push_back(nfa_step_fixture("nfa_step/literal", "a*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_step/any", ".*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_step/choice", "[xyza]*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_step/anti_choice", "[^xyz]*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_step/word", "\\w*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_step/digit", "\\d*!", digits));
+
+        // add_state_with_epsilon_closure: every byte re-enters a closure
+        // through sixteen alternatives, or through nested captures.
+        fixtures.push_back(nfa_step_fixture("nfa_closure/alternation16", "(b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|a)*!", letters));
+        fixtures.push_back(nfa_step_fixture("nfa_closure/nested_groups", "((((a)*)*)*)*!", letters));
+
+        fixtures.push_back(dfa_fixture("dfa/literal", "timeout", log_text));
+        fixtures.push_back(dfa_fixture("dfa/alternation", "error|warning|retry", log_text));
+        fixtures.push_back(dfa_fixture("dfa/class_run", "\\w+_\\d+", log_text));
+        fixtures.push_back(dfa_fixture("dfa/word_dense", "\\w+", log_text));
+
+        {
+            std::shared_ptr<NFAState> nfa = compile_regex_to_nfa("(\\w)\\1");
+            auto matcher = std::make_shared<BacktrackingMatcher>(build_backtracking_matcher(nfa));
+            fixtures.push_back({"backtrack/backreference", log_text.size(), [nfa, matcher, &log_text]
+                                { return match_text_with_backtracking(*matcher, log_text).matches.size(); }});
+        }
+
+        // Prefilters: the -F literal automaton and the token filter.
+        {
+            std::vector<std::string> literals;
+            for (int index = 0; index < 200; ++index)
+                literals.push_back("id" + std::to_string(index * 7919));
+            literals.push_back("timeout");
+            auto automaton = std::make_shared<LiteralAutomaton>(build_literal_automaton(literals));
+            fixtures.push_back({"prefilter/literal_set", log_text.size(), [automaton, &log_text]
+                                { return match_text_with_literals(*automaton, log_text).matches.size(); }});
+
+            TokenDelimiters delimiters = make_token_delimiters(DEFAULT_TOKEN_DELIMITERS);
+            write_token_filter(token_filter_path, literals, delimiters);
+            auto filter = std::make_shared<TokenFilter>();
+            load_token_filter(token_filter_path, *filter);
+            fixtures.push_back({"prefilter/token_filter", log_text.size(), [filter, delimiters, &log_text]
+                                { return match_text_with_token_filter(*filter, delimiters, log_text).matches.size(); }});
+        }
+
+        fixtures.push_back({"output/count_newlines", log_text.size(), [&log_text]
+                            { return count_newlines(log_text.data(), log_text.data() + log_text.size()); }});
+
+        // Output formatting of a dense match set, written to a null stream.
+        {
+            std::shared_ptr<NFAState> nfa = compile_regex_to_nfa("error|user_42");
+            LazyDFA dfa = build_lazy_dfa(nfa);
+            auto match_info = std::make_shared<MatchInfo>(match_text_with_dfa(dfa, log_text));
+            for (bool use_color : {false, true})
+            {
+                fixtures.push_back({use_color ? "output/format_color" : "output/format_plain", log_text.size(), [match_info, use_color, &log_text]
+                                    {
+                                        NullBuffer null_buffer;
+                                        std::ostream out(&null_buffer);
+                                        LineCounter line_counter;
+                                        print_matching_lines(log_text, *match_info, use_color, &line_counter, "file.log:", out);
+                                        return line_counter.line_number;
+                                    }});
+            }
+        }
+        return fixtures;
+    }
+
+    Measurement measure(const Fixture &fixture, double min_seconds)
+    {
+        using Clock = std::chrono::steady_clock;
+        volatile size_t sink = fixture.run(); // Warm caches and the lazy DFA
+        Measurement best{1e300, 1e300};
+        auto measuring_start = Clock::now();
+        int runs = 0;
+        while (runs < 3 || std::chrono::duration<double>(Clock::now() - measuring_start).count() < min_seconds)
+        {
+            uint64_t cycles_start = read_cycle_counter();
+            auto run_start = Clock::now();
+            sink = sink + fixture.run();
+            double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - run_start).count();
+            uint64_t cycles = read_cycle_counter() - cycles_start;
+            best.ns_per_byte = std::min(best.ns_per_byte, nanoseconds / fixture.bytes_per_run);
+            best.cycles_per_byte = std::min(best.cycles_per_byte, static_cast<double>(cycles) / fixture.bytes_per_run);
+            runs++;
+        }
+#if !defined(BENCH_HAS_RDTSC)
+        best.cycles_per_byte = -1;
+#endif
+        return best;
+    }
+
+    // Baseline lines are "name ns_per_byte"; '#' starts a comment.
+    std::map<std::string, double> read_baseline(const std::string &path)
+    {
+        std::map<std::string, double> baseline;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            std::string name;
+            double ns_per_byte;
+            if (fields >> name >> ns_per_byte)
+                baseline[name] = ns_per_byte;
+        }
+        return baseline;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    std::string baseline_path = GREP_BENCH_BASELINE;
+    double min_seconds = 0.2;
+    bool write_baseline = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.find("--filter=") == 0)
+            filter = arg.substr(9);
+        else if (arg.find("--min-time=") == 0)
+            min_seconds = std::atof(arg.c_str() + 11);
+        else if (arg.find("--baseline=") == 0)
+            baseline_path = arg.substr(11);
+        else if (arg == "--write-baseline")
+            write_baseline = true;
+        else
+        {
+            std::cerr << "Usage: micro_bench [--filter=substring] [--min-time=seconds] [--baseline=file] [--write-baseline]\n";
+            return 1;
+        }
+    }
+
+    const std::string log_text = make_log_text(4 << 20);
+    std::string token_filter_path = (std::filesystem::temp_directory_path() / "micro_bench.tokens").string();
+    std::vector<Fixture> fixtures;
+    try
+    {
+        fixtures = make_fixtures(log_text, token_filter_path);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    std::map<std::string, double> baseline = read_baseline(baseline_path);
+    std::vector<std::pair<std::string, double>> results;
+
+    std::cout << std::left << std::setw(30) << "fixture" << std::right << std::setw(10) << "ns/byte" << std::setw(14)
+              << "cycles/byte" << std::setw(12) << "baseline" << std::setw(10) << "change" << '\n';
+    std::cout << std::fixed;
+    for (const Fixture &fixture : fixtures)
+    {
+        if (!filter.empty() && fixture.name.find(filter) == std::string::npos)
+            continue;
+        Measurement measurement = measure(fixture, min_seconds);
+        results.push_back({fixture.name, measurement.ns_per_byte});
+
+        std::cout << std::left << std::setw(30) << fixture.name << std::right << std::setprecision(3) << std::setw(10)
+                  << measurement.ns_per_byte << std::setw(14);
+        if (measurement.cycles_per_byte >= 0)
+            std::cout << measurement.cycles_per_byte;
+        else
+            std::cout << "n/a";
+        auto stored = baseline.find(fixture.name);
+        if (stored != baseline.end())
+        {
+            double change = (measurement.ns_per_byte / stored->second - 1) * 100;
+            std::cout << std::setw(12) << stored->second << std::setw(9) << std::showpos << std::setprecision(1) << change << '%'
+                      << std::noshowpos;
+        }
+        std::cout << '\n';
+    }
+    std::filesystem::remove(token_filter_path);
+
+    if (write_baseline)
+    {
+        // Fixtures left out by --filter keep their stored numbers.
+        for (const auto &[name, ns_per_byte] : results)
+            baseline[name] = ns_per_byte;
+        std::ofstream out(baseline_path);
+        out << "# Microbenchmark baseline: fixture ns/byte, written by micro_bench --write-baseline\n";
+        for (const auto &[name, ns_per_byte] : baseline)
+            out << name << ' ' << std::setprecision(4) << ns_per_byte << '\n';
+        if (!out)
+        {
+            std::cerr << "Error: cannot write baseline " << baseline_path << '\n';
+            return 1;
+        }
+        std::cout << "Baseline written to " << baseline_path << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,688 @@
+#include "backtracking_matcher.hpp"
+
+#include <algorithm>
+#include <array>
+#include <set>
+
+namespace
+{
+    constexpr size_t UNSET = static_cast<size_t>(-1);
+    constexpr size_t INTERRUPTED = UNSET - 1;
+    constexpr uint32_t DEADLINE_CHECK_INTERVAL = 4096; // Steps between deadline checks
+    constexpr size_t MAX_CLOSURE_PATHS = 16;           // Wider closures are walked
+    constexpr size_t MAX_CLOSURE_VISITS = 256;         // Bounds the path search per closure
+
+    bool is_backreference(const NFAState &state)
+    {
+        return state.character_code >= OPCODE_BACKREF_START && state.character_code < OPCODE_MATCHED;
+    }
+
+    bool is_consuming(const NFAState &state)
+    {
+        switch (state.character_code)
+        {
+        case OPCODE_SPLIT:
+        case OPCODE_MATCH_START:
+        case OPCODE_MATCH_END:
+        case OPCODE_MATCHED:
+            return false;
+        default:
+            return !is_backreference(state);
+        }
+    }
+
+    bool is_branching_split(const NFAState &state)
+    {
+        return state.character_code == OPCODE_SPLIT && state.alternative_transition;
+    }
+
+    bool accepted_bytes_overlap(const NFAState &first, const NFAState &second)
+    {
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            char input_char = static_cast<char>(byte);
+            if (state_accepts_character(first, input_char) && state_accepts_character(second, input_char))
+                return true;
+        }
+        return false;
+    }
+
+    // The set engines treat atomic markers as plain epsilons. That matches the
+    // same spans when the body has no choices at all, or when it is a single
+    // quantified state that whatever follows the group can never start with,
+    // so the plain quantifier has to consume the whole run as well.
+    bool matches_like_plain_group(const AtomicGroup &group)
+    {
+        if (std::none_of(group.body.begin(), group.body.end(), [](const NFAState *state)
+                         { return is_branching_split(*state); }))
+            return true;
+
+        const NFAState *repeated_state = group.repeated_state;
+        if (!repeated_state || state_accepts_character(*repeated_state, '\n'))
+            return false;
+
+        std::set<const NFAState *> visited_states;
+        std::vector<const NFAState *> pending_states = {group.end_marker->primary_transition};
+        while (!pending_states.empty())
+        {
+            const NFAState *state = pending_states.back();
+            pending_states.pop_back();
+            if (!state || !visited_states.insert(state).second)
+                continue;
+            if (state->character_code == OPCODE_SPLIT)
+            {
+                pending_states.push_back(state->primary_transition);
+                pending_states.push_back(state->alternative_transition);
+                continue;
+            }
+            if (!is_consuming(*state) || accepted_bytes_overlap(*repeated_state, *state))
+                return false;
+        }
+        return true;
+    }
+
+    // Finds the paths of a closure depth first in the order the walk in
+    // backtrack_from would take them.
+    struct ClosureSearch
+    {
+        struct FoundPath
+        {
+            NFAState *state;
+            std::vector<CaptureBoundEffect> effects; // Net effect per bound, ordered by bound
+            bool needs_line_start;
+            bool needs_line_end;
+        };
+
+        std::vector<bool> on_path; // Splits on the path being followed, by state_id
+        std::vector<CaptureBoundEffect> path_effects;
+        bool needs_line_start = false;
+        bool needs_line_end = false;
+        size_t visits = 0;
+        std::vector<FoundPath> paths;
+
+        // False if the closure of state cannot be stored.
+        bool find(NFAState *state)
+        {
+            paths.clear();
+            visits = 0;
+            return visit(state);
+        }
+
+        bool visit(NFAState *state)
+        {
+            if (!state)
+                return true;
+            if (++visits > MAX_CLOSURE_VISITS)
+                return false;
+
+            int code = state->character_code;
+            if (code == OPCODE_SPLIT)
+            {
+                if (state->atomic_group_start >= 0 || state->atomic_group_end >= 0)
+                    return false;
+                if (on_path[state->state_id])
+                    return true; // An empty loop iteration, which the walk abandons
+                on_path[state->state_id] = true;
+                size_t effect_count = path_effects.size();
+                if (state->capture_group_start >= 0)
+                {
+                    path_effects.push_back({2 * state->capture_group_start, true});
+                    path_effects.push_back({2 * state->capture_group_start + 1, false});
+                }
+                if (state->capture_group_end >= 0)
+                    path_effects.push_back({2 * state->capture_group_end + 1, true});
+                bool storable = visit(state->primary_transition) && visit(state->alternative_transition);
+                path_effects.resize(effect_count);
+                on_path[state->state_id] = false;
+                return storable;
+            }
+            if (code == OPCODE_MATCH_START || code == OPCODE_MATCH_END)
+            {
+                bool &needs_anchor = code == OPCODE_MATCH_START ? needs_line_start : needs_line_end;
+                bool needed_before = needs_anchor;
+                needs_anchor = true;
+                bool storable = visit(state->primary_transition);
+                needs_anchor = needed_before;
+                return storable;
+            }
+            if (is_backreference(*state))
+                return false;
+            add_path(state);
+            return paths.size() <= MAX_CLOSURE_PATHS;
+        }
+
+        void add_path(NFAState *state)
+        {
+            FoundPath path{state, {}, needs_line_start, needs_line_end};
+            for (const CaptureBoundEffect &effect : path_effects)
+            {
+                auto same_bound = std::find_if(path.effects.begin(), path.effects.end(), [&](const CaptureBoundEffect &earlier)
+                                               { return earlier.bound == effect.bound; });
+                if (same_bound != path.effects.end())
+                    same_bound->at_position = effect.at_position;
+                else
+                    path.effects.push_back(effect);
+            }
+            std::sort(path.effects.begin(), path.effects.end(), [](const CaptureBoundEffect &first, const CaptureBoundEffect &second)
+                      { return first.bound < second.bound; });
+
+            // A path to the same state with the same captures and anchors as
+            // an earlier one can only fail the same way, once that one has.
+            auto same_effects = [](const std::vector<CaptureBoundEffect> &first, const std::vector<CaptureBoundEffect> &second)
+            {
+                return std::equal(first.begin(), first.end(), second.begin(), second.end(), [](const CaptureBoundEffect &a, const CaptureBoundEffect &b)
+                                  { return a.bound == b.bound && a.at_position == b.at_position; });
+            };
+            bool seen = std::any_of(paths.begin(), paths.end(), [&](const FoundPath &earlier)
+                                    { return earlier.state == path.state && earlier.needs_line_start == path.needs_line_start &&
+                                             earlier.needs_line_end == path.needs_line_end && same_effects(earlier.effects, path.effects); });
+            if (!seen)
+                paths.push_back(std::move(path));
+        }
+    };
+
+    void store_closures(BacktrackingMatcher &matcher)
+    {
+        matcher.closure_of.assign(matcher.nfa_states.size(), BacktrackingMatcher::NO_CLOSURE);
+        ClosureSearch search;
+        search.on_path.assign(matcher.nfa_states.size(), false);
+        for (NFAState *state : matcher.nfa_states)
+        {
+            int code = state->character_code;
+            if (code != OPCODE_SPLIT && code != OPCODE_MATCH_START && code != OPCODE_MATCH_END)
+                continue;
+            if (!search.find(state) || search.paths.empty())
+                continue;
+
+            matcher.closure_of[state->state_id] = static_cast<uint32_t>(matcher.closure_paths.size());
+            for (const ClosureSearch::FoundPath &found : search.paths)
+            {
+                ClosurePath &path = matcher.closure_paths.emplace_back();
+                path.state = found.state;
+                path.first_effect = static_cast<uint32_t>(matcher.closure_effects.size());
+                path.effect_count = static_cast<uint32_t>(found.effects.size());
+                path.needs_line_start = found.needs_line_start;
+                path.needs_line_end = found.needs_line_end;
+                matcher.closure_effects.insert(matcher.closure_effects.end(), found.effects.begin(), found.effects.end());
+            }
+            matcher.closure_paths.back().is_last = true;
+        }
+    }
+
+    enum class FrameKind : uint8_t
+    {
+        TRY_STATE,           // Resume at state, position
+        TRY_CLOSURE_PATH,    // Resume at closure path index, position
+        RESTORE_CAPTURE,     // capture_bounds[index] = position
+        RESTORE_SPLIT_ENTRY, // split_entry[index] = position
+        ATOMIC_BARRIER       // Entry into atomic group index
+    };
+
+    struct BacktrackFrame
+    {
+        FrameKind kind;
+        int index;
+        size_t position;
+        NFAState *state;
+    };
+
+    struct BacktrackScratch
+    {
+        std::vector<BacktrackFrame> stack;
+        std::vector<size_t> capture_bounds; // Start and end per group, UNSET when not captured
+        std::vector<size_t> split_entry;    // Position each split was last entered at on this path
+        uint32_t steps_until_check = DEADLINE_CHECK_INTERVAL;
+    };
+
+    // Leaving atomic group group_id: drops every backtrack point taken since
+    // its barrier but keeps the restore frames, so captures and split entries
+    // still unwind correctly if matching fails further on.
+    void cut_atomic_group(std::vector<BacktrackFrame> &stack, int group_id)
+    {
+        size_t barrier = stack.size();
+        while (barrier > 0)
+        {
+            --barrier;
+            if (stack[barrier].kind == FrameKind::ATOMIC_BARRIER && stack[barrier].index == group_id)
+                break;
+        }
+        auto kept_end = std::remove_if(stack.begin() + barrier, stack.end(), [](const BacktrackFrame &frame)
+                                       { return frame.kind == FrameKind::TRY_STATE || frame.kind == FrameKind::TRY_CLOSURE_PATH ||
+                                                frame.kind == FrameKind::ATOMIC_BARRIER; });
+        stack.erase(kept_end, stack.end());
+    }
+
+    bool holds_at(int anchor_code, std::string_view text, size_t position)
+    {
+        return anchor_code == OPCODE_MATCH_START ? position == 0 || text[position - 1] == '\n'
+                                                 : position == text.size() || text[position] == '\n';
+    }
+
+    // Starts down closure path index at position: queues the next path of
+    // the closure, then applies this one's captures. Returns the state the
+    // path ends at, or nullptr if one of its anchors fails here.
+    NFAState *take_closure_path(const BacktrackingMatcher &matcher, std::string_view text, uint32_t index, size_t position,
+                                BacktrackScratch &scratch)
+    {
+        const ClosurePath &path = matcher.closure_paths[index];
+        if (!path.is_last)
+            scratch.stack.push_back({FrameKind::TRY_CLOSURE_PATH, static_cast<int>(index + 1), position, nullptr});
+        if ((path.needs_line_start && !holds_at(OPCODE_MATCH_START, text, position)) ||
+            (path.needs_line_end && !holds_at(OPCODE_MATCH_END, text, position)))
+            return nullptr;
+        for (uint32_t i = 0; i < path.effect_count; ++i)
+        {
+            const CaptureBoundEffect &effect = matcher.closure_effects[path.first_effect + i];
+            scratch.stack.push_back({FrameKind::RESTORE_CAPTURE, effect.bound, scratch.capture_bounds[effect.bound], nullptr});
+            scratch.capture_bounds[effect.bound] = effect.at_position ? position : UNSET;
+        }
+        return path.state;
+    }
+
+    // Where the matcher goes after consuming up to position and moving to
+    // next. Stored closures are only taken here and at the start, where no
+    // split on the current path was entered at position yet; their paths
+    // end in a byte or the match, so the split entries they skip setting
+    // are never compared at position again.
+    NFAState *enter_state(const BacktrackingMatcher &matcher, std::string_view text, NFAState *next, size_t position,
+                          BacktrackScratch &scratch)
+    {
+        if (!next || matcher.closure_of[next->state_id] == BacktrackingMatcher::NO_CLOSURE)
+            return next;
+        return take_closure_path(matcher, text, matcher.closure_of[next->state_id], position, scratch);
+    }
+
+    // Returns the end of the shortest match starting at start, UNSET if there
+    // is none, or INTERRUPTED once deadline has expired. Paths are still
+    // tried in priority order, which decides what the groups hold; once one
+    // matches, only paths that can still end sooner are followed.
+    size_t backtrack_from(const BacktrackingMatcher &matcher, std::string_view text, size_t start, const Deadline &deadline,
+                          BacktrackScratch &scratch)
+    {
+        std::vector<BacktrackFrame> &stack = scratch.stack;
+        std::vector<size_t> &capture_bounds = scratch.capture_bounds;
+        std::vector<size_t> &split_entry = scratch.split_entry;
+        stack.clear();
+        capture_bounds.assign(2 * (matcher.capture_group_count + 1), UNSET);
+        split_entry.assign(matcher.nfa_states.size(), UNSET);
+        size_t shortest_end = UNSET;
+
+        uint32_t start_closure = matcher.closure_of[matcher.nfa_start_state->state_id];
+        if (start_closure != BacktrackingMatcher::NO_CLOSURE)
+            stack.push_back({FrameKind::TRY_CLOSURE_PATH, static_cast<int>(start_closure), start, nullptr});
+        else
+            stack.push_back({FrameKind::TRY_STATE, 0, start, matcher.nfa_start_state});
+        while (!stack.empty())
+        {
+            BacktrackFrame frame = stack.back();
+            stack.pop_back();
+            NFAState *state = frame.state;
+            size_t position = frame.position;
+            if (frame.kind == FrameKind::RESTORE_CAPTURE)
+            {
+                capture_bounds[frame.index] = frame.position;
+                continue;
+            }
+            if (frame.kind == FrameKind::RESTORE_SPLIT_ENTRY)
+            {
+                split_entry[frame.index] = frame.position;
+                continue;
+            }
+            if (frame.kind == FrameKind::ATOMIC_BARRIER)
+                continue;
+            if (frame.kind == FrameKind::TRY_CLOSURE_PATH)
+                state = take_closure_path(matcher, text, static_cast<uint32_t>(frame.index), position, scratch);
+
+            // Follow the primary transitions, leaving a frame at every split.
+            while (state && position < shortest_end)
+            {
+                profiler.total_steps++;
+                if (--scratch.steps_until_check == 0)
+                {
+                    if (deadline.expired())
+                        return INTERRUPTED;
+                    scratch.steps_until_check = DEADLINE_CHECK_INTERVAL;
+                }
+                int code = state->character_code;
+                if (code == OPCODE_MATCHED)
+                {
+                    if (position == start)
+                        return position;
+                    shortest_end = position;
+                    break;
+                }
+
+                if (code == OPCODE_SPLIT)
+                {
+                    // Back at a split without consuming anything: an empty
+                    // loop iteration, which cannot lead anywhere new.
+                    if (split_entry[state->state_id] == position)
+                        break;
+                    stack.push_back({FrameKind::RESTORE_SPLIT_ENTRY, state->state_id, split_entry[state->state_id], nullptr});
+                    split_entry[state->state_id] = position;
+
+                    if (state->capture_group_start >= 0)
+                    {
+                        int bound = 2 * state->capture_group_start;
+                        stack.push_back({FrameKind::RESTORE_CAPTURE, bound, capture_bounds[bound], nullptr});
+                        stack.push_back({FrameKind::RESTORE_CAPTURE, bound + 1, capture_bounds[bound + 1], nullptr});
+                        capture_bounds[bound] = position;
+                        capture_bounds[bound + 1] = UNSET;
+                    }
+                    if (state->capture_group_end >= 0)
+                    {
+                        int bound = 2 * state->capture_group_end + 1;
+                        stack.push_back({FrameKind::RESTORE_CAPTURE, bound, capture_bounds[bound], nullptr});
+                        capture_bounds[bound] = position;
+                    }
+                    if (state->atomic_group_start >= 0)
+                        stack.push_back({FrameKind::ATOMIC_BARRIER, state->atomic_group_start, position, nullptr});
+                    if (state->atomic_group_end >= 0)
+                        cut_atomic_group(stack, state->atomic_group_end);
+
+                    if (state->alternative_transition)
+                        stack.push_back({FrameKind::TRY_STATE, 0, position, state->alternative_transition});
+                    state = state->primary_transition;
+                    continue;
+                }
+
+                if (code == OPCODE_MATCH_START || code == OPCODE_MATCH_END)
+                {
+                    if (!holds_at(code, text, position))
+                        break;
+                    state = state->primary_transition;
+                    continue;
+                }
+
+                if (is_backreference(*state))
+                {
+                    // A group that has not captured anything fails, as in Perl.
+                    int group_id = code - OPCODE_BACKREF_START;
+                    if (group_id > matcher.capture_group_count)
+                        break;
+                    size_t captured_start = capture_bounds[2 * group_id];
+                    size_t captured_end = capture_bounds[2 * group_id + 1];
+                    if (captured_start == UNSET || captured_end == UNSET)
+                        break;
+                    std::string_view captured = text.substr(captured_start, captured_end - captured_start);
+                    if (text.substr(position, captured.size()) != captured)
+                        break;
+                    position += captured.size();
+                    state = captured.empty() ? state->primary_transition : enter_state(matcher, text, state->primary_transition, position, scratch);
+                    continue;
+                }
+
+                if (position == text.size() || !state_accepts_character(*state, text[position]))
+                    break;
+                position++;
+                state = enter_state(matcher, text, state->primary_transition, position, scratch);
+            }
+        }
+        return shortest_end;
+    }
+
+    // Appends the matches in text to result_info, offset by base. Returns
+    // false, with interrupted set, once deadline has expired.
+    bool find_backtracking_matches(const BacktrackingMatcher &matcher, std::string_view text, size_t base, const Deadline &deadline,
+                                   BacktrackScratch &scratch, MatchInfo &result_info)
+    {
+        size_t search_from = 0;
+        while (search_from <= text.size())
+        {
+            if (!matcher.try_every_position)
+            {
+                while (search_from < text.size() && !matcher.can_begin_match[static_cast<unsigned char>(text[search_from])])
+                    ++search_from;
+                if (search_from == text.size())
+                    break;
+            }
+
+            size_t match_end = backtrack_from(matcher, text, search_from, deadline, scratch);
+            if (match_end == INTERRUPTED)
+            {
+                result_info.interrupted = true;
+                return false;
+            }
+            if (match_end == UNSET)
+            {
+                search_from++;
+                continue;
+            }
+            result_info.matches.push_back({base + search_from, base + match_end});
+            search_from += std::max((size_t)1, match_end - search_from);
+        }
+        return true;
+    }
+}
+
+std::vector<AtomicGroup> find_atomic_groups(const std::vector<NFAState *> &nfa_states)
+{
+    std::vector<AtomicGroup> groups;
+    for (NFAState *start_marker : nfa_states)
+    {
+        if (start_marker->atomic_group_start < 0)
+            continue;
+
+        AtomicGroup group;
+        group.start_marker = start_marker;
+        std::set<NFAState *> visited_states;
+        std::vector<NFAState *> pending_states = {start_marker->primary_transition};
+        while (!pending_states.empty())
+        {
+            NFAState *state = pending_states.back();
+            pending_states.pop_back();
+            if (!state || !visited_states.insert(state).second)
+                continue;
+            if (state->atomic_group_end == start_marker->atomic_group_start)
+            {
+                group.end_marker = state;
+                continue;
+            }
+            group.body.push_back(state);
+            pending_states.push_back(state->primary_transition);
+            pending_states.push_back(state->alternative_transition);
+        }
+
+        // A quantifier over one state leaves exactly that state and its split.
+        if (group.body.size() == 2)
+        {
+            NFAState *first = group.body[0];
+            NFAState *second = group.body[1];
+            if (is_branching_split(*first) && is_consuming(*second))
+                group.repeated_state = second;
+            else if (is_branching_split(*second) && is_consuming(*first))
+                group.repeated_state = first;
+        }
+        groups.push_back(std::move(group));
+    }
+    return groups;
+}
+
+bool nfa_needs_backtracking(const std::vector<NFAState *> &nfa_states)
+{
+    if (nfa_uses_backreferences(nfa_states))
+        return true;
+    std::vector<AtomicGroup> groups = find_atomic_groups(nfa_states);
+    return !std::all_of(groups.begin(), groups.end(), matches_like_plain_group);
+}
+
+BacktrackingMatcher build_backtracking_matcher(std::shared_ptr<NFAState> nfa_start_state)
+{
+    BacktrackingMatcher matcher;
+    matcher.nfa_start_state = nfa_start_state.get();
+    number_nfa_states(nfa_start_state, matcher.nfa_states);
+    for (const NFAState *state : matcher.nfa_states)
+        matcher.capture_group_count = std::max(matcher.capture_group_count, state->capture_group_start);
+
+    // First bytes of the pattern, treating anchors as always satisfied. If a
+    // match can end or reach a backreference before reading anything, every
+    // position has to be tried.
+    std::set<const NFAState *> visited_states;
+    std::vector<const NFAState *> pending_states = {matcher.nfa_start_state};
+    while (!pending_states.empty())
+    {
+        const NFAState *state = pending_states.back();
+        pending_states.pop_back();
+        if (!state || !visited_states.insert(state).second)
+            continue;
+        if (state->character_code == OPCODE_SPLIT || state->character_code == OPCODE_MATCH_START || state->character_code == OPCODE_MATCH_END)
+        {
+            pending_states.push_back(state->primary_transition);
+            pending_states.push_back(state->alternative_transition);
+            continue;
+        }
+        if (!is_consuming(*state))
+        {
+            matcher.try_every_position = true;
+            continue;
+        }
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            if (state_accepts_character(*state, static_cast<char>(byte)))
+                matcher.can_begin_match[byte] = true;
+        }
+    }
+
+    store_closures(matcher);
+    return matcher;
+}
+
+MatchInfo match_text_with_backtracking(const BacktrackingMatcher &matcher, std::string_view text, const Deadline &deadline)
+{
+    MatchInfo result_info = {false, {}};
+    BacktrackScratch scratch;
+    find_backtracking_matches(matcher, text, 0, deadline, scratch, result_info);
+    result_info.found = !result_info.matches.empty();
+    return result_info;
+}
+
+std::shared_ptr<NFAState> relax_backreferences(std::shared_ptr<NFAState> nfa_start_state)
+{
+    std::vector<NFAState *> nfa_states;
+    number_nfa_states(nfa_start_state, nfa_states);
+
+    // Built with index transitions (-1 for none) first, since copies are
+    // appended while the states are still being wired. Copies are taken
+    // from nfa_states, which stay as compiled.
+    constexpr int NO_STATE = -1;
+    std::vector<NFAState> states;
+    std::vector<std::array<int, 2>> transitions;
+    auto index_of = [](const NFAState *state)
+    { return state ? state->state_id : NO_STATE; };
+    for (NFAState *state : nfa_states)
+    {
+        states.push_back(*state);
+        transitions.push_back({index_of(state->primary_transition), index_of(state->alternative_transition)});
+    }
+    auto add_state = [&](int character_code)
+    {
+        NFAState &state = states.emplace_back();
+        state.character_code = character_code;
+        transitions.push_back({NO_STATE, NO_STATE});
+        return static_cast<int>(states.size() - 1);
+    };
+    // Turns state into a loop over any bytes before next.
+    auto make_any_run = [&](int state, int next)
+    {
+        int any_byte = add_state(OPCODE_MATCH_ANY);
+        transitions[any_byte] = {state, NO_STATE};
+        states[state].character_code = OPCODE_SPLIT;
+        transitions[state] = {any_byte, next};
+    };
+
+    std::vector<int> group_start(nfa_states.size() + 1, NO_STATE);
+    std::vector<int> group_end(nfa_states.size() + 1, NO_STATE);
+    for (const NFAState *state : nfa_states)
+    {
+        if (state->capture_group_start > 0 && static_cast<size_t>(state->capture_group_start) < group_start.size())
+            group_start[state->capture_group_start] = state->state_id;
+        if (state->capture_group_end > 0 && static_cast<size_t>(state->capture_group_end) < group_end.size())
+            group_end[state->capture_group_end] = state->state_id;
+    }
+
+    for (const NFAState *backreference : nfa_states)
+    {
+        if (!is_backreference(*backreference))
+            continue;
+        int reference = backreference->state_id;
+        int next = transitions[reference][0];
+        size_t group_id = static_cast<size_t>(backreference->character_code - OPCODE_BACKREF_START);
+        if (group_id >= group_start.size() || group_start[group_id] == NO_STATE || group_end[group_id] == NO_STATE)
+        {
+            make_any_run(reference, next);
+            continue;
+        }
+
+        // A copy of the group's body leading to next. Anchors in it become
+        // plain epsilons, since the captured text is not matched again at
+        // its own position, and backreferences in it match any bytes.
+        int body_end = group_end[group_id];
+        std::vector<int> copy_of(nfa_states.size(), NO_STATE);
+        std::vector<int> pending;
+        auto copy = [&](int state)
+        {
+            if (state == NO_STATE || state == body_end)
+                return state == body_end ? next : NO_STATE;
+            if (copy_of[state] == NO_STATE)
+            {
+                copy_of[state] = static_cast<int>(states.size());
+                states.push_back(*nfa_states[state]);
+                transitions.push_back({NO_STATE, NO_STATE});
+                pending.push_back(state);
+            }
+            return copy_of[state];
+        };
+        int body_start = copy(index_of(nfa_states[group_start[group_id]]->primary_transition));
+        while (!pending.empty())
+        {
+            const NFAState *original = nfa_states[pending.back()];
+            pending.pop_back();
+            int copied = copy_of[original->state_id];
+            std::array<int, 2> targets = {copy(index_of(original->primary_transition)), copy(index_of(original->alternative_transition))};
+            transitions[copied] = targets;
+            int code = states[copied].character_code;
+            if (code == OPCODE_MATCH_START || code == OPCODE_MATCH_END)
+                states[copied].character_code = OPCODE_SPLIT;
+            else if (is_backreference(states[copied]))
+                make_any_run(copied, targets[0]);
+        }
+        states[reference].character_code = OPCODE_SPLIT;
+        transitions[reference] = {body_start, NO_STATE};
+    }
+
+    auto arena = std::make_shared<NFAArena>();
+    arena->states = std::move(states);
+    NFAState *base = arena->states.data();
+    for (size_t index = 0; index < arena->states.size(); ++index)
+    {
+        NFAState &state = arena->states[index];
+        state.state_id = static_cast<int>(index);
+        state.primary_transition = transitions[index][0] == NO_STATE ? nullptr : base + transitions[index][0];
+        state.alternative_transition = transitions[index][1] == NO_STATE ? nullptr : base + transitions[index][1];
+    }
+    return std::shared_ptr<NFAState>(arena, base + nfa_start_state->state_id);
+}
+
+MatchInfo match_text_with_line_filter(const BacktrackingMatcher &matcher, LazyDFA &line_filter, std::string_view text,
+                                      const Deadline &deadline)
+{
+    MatchInfo candidates = match_text_with_dfa(line_filter, text);
+    MatchInfo result_info = {false, {}};
+    result_info.prefilter_skipped_bytes = candidates.prefilter_skipped_bytes;
+    BacktrackScratch scratch;
+
+    size_t searched_to = 0; // Lines before this offset have been backtracked
+    for (const auto &[candidate_start, candidate_end] : candidates.matches)
+    {
+        if (candidate_start < searched_to)
+            continue;
+        size_t line_start = candidate_start == 0 ? std::string_view::npos : text.rfind('\n', candidate_start - 1);
+        line_start = line_start == std::string_view::npos ? 0 : line_start + 1;
+        size_t line_end = std::min(text.find('\n', candidate_start), text.size());
+        if (!find_backtracking_matches(matcher, text.substr(line_start, line_end - line_start), line_start, deadline, scratch, result_info))
+            break;
+        searched_to = line_end + 1;
+    }
+    result_info.found = !result_info.matches.empty();
+    return result_info;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "deadline.hpp"
+#include "grep_engine.hpp"
+
+// --- Backtracking Matcher ---
+// Depth-first matcher for the patterns the set engines cannot run:
+// backreferences, and atomic groups whose commitment changes what matches.
+// Alternatives are tried in priority order as in Perl, which decides what
+// groups capture, but the shortest match at the leftmost position is
+// reported, so spans are the ones the DFA would report.
+// Atomic groups (?>...) and possessive quantifiers (*+, ++, ?+) discard the
+// backtrack points of their body once it has matched.
+struct AtomicGroup
+{
+    NFAState *start_marker = nullptr;
+    NFAState *end_marker = nullptr;
+    std::vector<NFAState *> body;       // States strictly between the markers
+    NFAState *repeated_state = nullptr; // Sole consuming state of a quantified single-state body
+};
+
+// One way through the splits and anchors that follow a state, ending at a
+// state that consumes a byte or ends the match.
+struct ClosurePath
+{
+    NFAState *state = nullptr;
+    uint32_t first_effect = 0; // Capture bounds the path sets, in closure_effects
+    uint32_t effect_count = 0;
+    bool needs_line_start = false; // The path passes a ^
+    bool needs_line_end = false;   // The path passes a $
+    bool is_last = false;          // Last path of its closure
+};
+
+struct CaptureBoundEffect
+{
+    int bound;        // 2 * group for its start, 2 * group + 1 for its end
+    bool at_position; // Set to the current position, or cleared
+};
+
+struct BacktrackingMatcher
+{
+    static constexpr uint32_t NO_CLOSURE = static_cast<uint32_t>(-1);
+
+    std::vector<NFAState *> nfa_states; // Indexed by NFAState::state_id
+    NFAState *nfa_start_state = nullptr;
+    int capture_group_count = 0;
+    std::array<bool, 256> can_begin_match{}; // Bytes a match can start with
+    bool try_every_position = false;         // Set when a match may start with no byte at all
+
+    // Epsilon closures of split and anchor states, built once so the split
+    // chains after each consumed byte are not walked again on every attempt.
+    // A closure's paths are stored in the order they would be tried. States
+    // whose closure crosses an atomic marker, stops at a backreference or
+    // branches too widely are walked instead and have NO_CLOSURE.
+    std::vector<uint32_t> closure_of; // First path per state_id
+    std::vector<ClosurePath> closure_paths;
+    std::vector<CaptureBoundEffect> closure_effects;
+};
+
+std::vector<AtomicGroup> find_atomic_groups(const std::vector<NFAState *> &nfa_states);
+
+// True if the pattern needs the backtracking matcher: it has backreferences,
+// or an atomic group that the set engines, which ignore atomicity, would
+// match differently.
+bool nfa_needs_backtracking(const std::vector<NFAState *> &nfa_states);
+
+BacktrackingMatcher build_backtracking_matcher(std::shared_ptr<NFAState> nfa_start_state);
+// Polls deadline every few thousand steps; once it has expired the matches
+// found so far are returned with interrupted set.
+MatchInfo match_text_with_backtracking(const BacktrackingMatcher &matcher, std::string_view text, const Deadline &deadline = {});
+
+// --- Line Filter ---
+// Backtracking tracks captures at every position it starts from. Outside
+// multiline mode no match crosses a line, so a lazy DFA first looks for
+// matches of a relaxed pattern, in which every backreference matches
+// whatever its group's pattern could (anchors aside) and atomic groups are
+// plain groups. Every match of the real pattern is one of the relaxed
+// pattern, so only the lines the DFA finds a match in are backtracked, and
+// capture work follows the candidate lines rather than the scanned bytes.
+std::shared_ptr<NFAState> relax_backreferences(std::shared_ptr<NFAState> nfa_start_state);
+
+// line_filter is a lazy DFA built from relax_backreferences of the
+// matcher's pattern. Returns the same matches as match_text_with_backtracking.
+MatchInfo match_text_with_line_filter(const BacktrackingMatcher &matcher, LazyDFA &line_filter, std::string_view text,
+                                      const Deadline &deadline = {});
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+
+// --- Time Budgets (--timeout, --file-timeout) ---
+// A point in time after which a search should stop, tagged with the option
+// that set it for reporting. The default deadline never expires, and
+// checking it does not read the clock.
+class Deadline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Deadline() = default;
+
+    // A deadline seconds from now, or none if seconds is not positive.
+    static Deadline after_seconds(double seconds, const char *option_name)
+    {
+        Deadline deadline;
+        if (seconds > 0)
+        {
+            deadline.expires_at = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+            deadline.option = option_name;
+        }
+        return deadline;
+    }
+
+    static const Deadline &earliest(const Deadline &first, const Deadline &second)
+    {
+        return second.expires_at < first.expires_at ? second : first;
+    }
+
+    bool expired() const { return expires_at != Clock::time_point::max() && Clock::now() >= expires_at; }
+    const char *option_name() const { return option; }
+
+private:
+    Clock::time_point expires_at = Clock::time_point::max();
+    const char *option = "";
+};
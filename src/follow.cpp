@@ -0,0 +1,245 @@
+#include "follow.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include "input_source.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_FOLLOW 1
+#endif
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#define GREP_HAS_INOTIFY 1
+#endif
+
+namespace
+{
+    // How often files are polled where inotify cannot watch them, and the
+    // longest wait between deadline checks.
+    constexpr std::chrono::milliseconds POLL_INTERVAL{500};
+}
+
+FileFollower::FileFollower(std::vector<std::string> paths) : buffer(InputSource::BLOCK_SIZE)
+{
+    for (std::string &path : paths)
+    {
+        FollowedFile file;
+        file.name = std::filesystem::path(path).filename().string();
+        file.path = std::move(path);
+        files.push_back(std::move(file));
+    }
+}
+
+#if defined(GREP_HAS_FOLLOW)
+
+FileFollower::~FileFollower()
+{
+    for (size_t i = 0; i < files.size(); i++)
+        close_file(i);
+    if (notify_fd >= 0)
+        close(notify_fd);
+}
+
+bool FileFollower::open_file(size_t index)
+{
+    FollowedFile &file = files[index];
+    file.fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file.fd < 0)
+        return false;
+    struct stat status;
+    if (fstat(file.fd, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        close_file(index);
+        return false;
+    }
+    file.device = static_cast<uint64_t>(status.st_dev);
+    file.inode = static_cast<uint64_t>(status.st_ino);
+    file.offset = 0;
+    file.pending.clear();
+    return true;
+}
+
+void FileFollower::close_file(size_t index)
+{
+    if (files[index].fd >= 0)
+        close(files[index].fd);
+    files[index].fd = -1;
+}
+
+void FileFollower::read_appended(size_t index, const LinesCallback &on_lines)
+{
+    FollowedFile &file = files[index];
+    while (true)
+    {
+        ssize_t length = pread(file.fd, buffer.data(), buffer.size(), static_cast<off_t>(file.offset));
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            return;
+        file.offset += static_cast<uint64_t>(length);
+
+        std::string_view chunk(buffer.data(), static_cast<size_t>(length));
+        size_t last_newline = chunk.rfind('\n');
+        if (last_newline == std::string_view::npos)
+        {
+            file.pending.append(chunk);
+            continue;
+        }
+        if (file.pending.empty())
+            on_lines(index, chunk.substr(0, last_newline + 1));
+        else
+        {
+            file.pending.append(chunk.substr(0, last_newline + 1));
+            on_lines(index, file.pending);
+            file.pending.clear();
+        }
+        file.pending.append(chunk.substr(last_newline + 1));
+    }
+}
+
+void FileFollower::check_file(size_t index, const LinesCallback &on_lines, const ResetCallback &on_reset)
+{
+    FollowedFile &file = files[index];
+    if (file.fd < 0)
+    {
+        if (!open_file(index))
+            return;
+        on_reset(index, "appeared, following it from the start");
+    }
+
+    struct stat status;
+    if (fstat(file.fd, &status) == 0 && static_cast<uint64_t>(status.st_size) < file.offset)
+    {
+        on_reset(index, "truncated, following it from the start");
+        file.offset = 0;
+        file.pending.clear();
+    }
+    read_appended(index, on_lines);
+
+    // Rotation: the path now names another file, or nothing. Whatever was
+    // written to the old file before it was renamed has just been read.
+    if (stat(file.path.c_str(), &status) == 0 && static_cast<uint64_t>(status.st_dev) == file.device &&
+        static_cast<uint64_t>(status.st_ino) == file.inode)
+        return;
+    if (!file.pending.empty())
+        on_lines(index, file.pending);
+    close_file(index);
+    if (open_file(index))
+    {
+        on_reset(index, "replaced, following the new file from the start");
+        read_appended(index, on_lines);
+    }
+    else
+        on_reset(index, "removed, waiting for it to reappear");
+}
+
+void FileFollower::run(const Deadline &deadline, const LinesCallback &on_lines, const ResetCallback &on_reset)
+{
+    // Files not covered by a directory watch are polled.
+    std::vector<bool> watched(files.size(), false);
+#if defined(GREP_HAS_INOTIFY)
+    // One watch per directory reports changes to every followed file in it
+    // by name, including files created or renamed into place later.
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (size_t i = 0; notify_fd >= 0 && i < files.size(); i++)
+    {
+        std::string directory = std::filesystem::path(files[i].path).parent_path().string();
+        int watch = inotify_add_watch(notify_fd, directory.empty() ? "." : directory.c_str(),
+                                      IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB);
+        if (watch >= 0)
+        {
+            watched_directories[watch].push_back(i);
+            watched[i] = true;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!open_file(i))
+            on_reset(i, "cannot be opened, waiting for it to appear");
+        else
+            read_appended(i, on_lines);
+    }
+
+#if defined(GREP_HAS_INOTIFY)
+    std::chrono::steady_clock::time_point next_sweep = std::chrono::steady_clock::now() + POLL_INTERVAL;
+#endif
+    while (!deadline.expired())
+    {
+#if defined(GREP_HAS_INOTIFY)
+        if (notify_fd >= 0)
+        {
+            pollfd ready{notify_fd, POLLIN, 0};
+            if (poll(&ready, 1, static_cast<int>(POLL_INTERVAL.count())) > 0)
+            {
+                alignas(inotify_event) char events[16 << 10];
+                ssize_t length;
+                while ((length = read(notify_fd, events, sizeof(events))) > 0)
+                {
+                    for (char *cursor = events; cursor < events + length;)
+                    {
+                        const inotify_event *event = reinterpret_cast<const inotify_event *>(cursor);
+                        cursor += sizeof(inotify_event) + event->len;
+                        auto directory = watched_directories.find(event->wd);
+                        if (directory == watched_directories.end())
+                            continue;
+                        for (size_t i : directory->second)
+                            if (event->len == 0 || files[i].name == event->name)
+                                check_file(i, on_lines, on_reset);
+                    }
+                }
+            }
+            if (std::chrono::steady_clock::now() >= next_sweep)
+            {
+                for (size_t i = 0; i < files.size(); i++)
+                    if (!watched[i])
+                        check_file(i, on_lines, on_reset);
+                next_sweep = std::chrono::steady_clock::now() + POLL_INTERVAL;
+            }
+            continue;
+        }
+#endif
+        std::this_thread::sleep_for(POLL_INTERVAL);
+        for (size_t i = 0; i < files.size(); i++)
+            check_file(i, on_lines, on_reset);
+    }
+}
+
+#else
+
+FileFollower::~FileFollower()
+{
+}
+
+bool FileFollower::open_file(size_t)
+{
+    return false;
+}
+
+void FileFollower::close_file(size_t)
+{
+}
+
+void FileFollower::read_appended(size_t, const LinesCallback &)
+{
+}
+
+void FileFollower::check_file(size_t, const LinesCallback &, const ResetCallback &)
+{
+}
+
+void FileFollower::run(const Deadline &, const LinesCallback &, const ResetCallback &)
+{
+    throw std::runtime_error("--follow is not supported on this platform");
+}
+
+#endif
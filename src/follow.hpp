@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "deadline.hpp"
+
+// --- Follow Mode (--follow) ---
+// Searches lines as they are appended to growing files, like tail -F piped
+// into a search but without the pipe. Each file is read from the offset
+// reached so far; an unfinished last line is held back until its '\n'
+// arrives. inotify watches on the files' directories (Linux) wake the
+// follower for the file that changed; elsewhere the files are polled. A
+// file that shrinks was truncated and is followed again from the start;
+// when its path comes to name another file (rename-based rotation) the old
+// file is read to its end and the new one followed from the start.
+class FileFollower
+{
+public:
+    // Whole lines appended to the file at index; the last line of a rotated
+    // file may lack its '\n'.
+    using LinesCallback = std::function<void(size_t file, std::string_view lines)>;
+    // The file's content starts over (truncated, replaced or not there), for
+    // the reason given.
+    using ResetCallback = std::function<void(size_t file, const char *reason)>;
+
+    explicit FileFollower(std::vector<std::string> paths);
+    FileFollower(const FileFollower &) = delete;
+    FileFollower &operator=(const FileFollower &) = delete;
+    ~FileFollower();
+
+    // Reads the files from their start and then follows them until deadline
+    // expires. Throws std::runtime_error where following is not supported.
+    void run(const Deadline &deadline, const LinesCallback &on_lines, const ResetCallback &on_reset);
+
+private:
+    struct FollowedFile
+    {
+        std::string path;
+        std::string name; // Last path component, as inotify reports it
+        int fd = -1;
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t offset = 0;
+        std::string pending; // Unfinished last line
+    };
+
+    bool open_file(size_t index);
+    void close_file(size_t index);
+    void read_appended(size_t index, const LinesCallback &on_lines);
+    void check_file(size_t index, const LinesCallback &on_lines, const ResetCallback &on_reset);
+
+    std::vector<FollowedFile> files;
+    std::vector<char> buffer;
+    int notify_fd = -1;
+    std::unordered_map<int, std::vector<size_t>> watched_directories; // inotify watch -> files in the directory
+};
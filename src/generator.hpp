@@ -0,0 +1,97 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+// --- Generator ---
+// Minimal pull-based coroutine generator (the standard library shipped with
+// our compilers has no std::generator yet). The body runs only when the
+// consumer advances, so a chain of generators processes one item at a time
+// end to end, and values yielded by reference stay valid until the next
+// advance.
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> current_value;
+        std::exception_ptr exception;
+
+        Generator get_return_object() { return Generator{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { exception = std::current_exception(); }
+
+        template <typename U>
+        std::suspend_always yield_value(U &&value)
+        {
+            current_value.emplace(std::forward<U>(value));
+            return {};
+        }
+    };
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        explicit iterator(std::coroutine_handle<promise_type> generator_handle) : handle(generator_handle) {}
+
+        T &operator*() const { return *handle.promise().current_value; }
+        iterator &operator++()
+        {
+            advance(handle);
+            return *this;
+        }
+        bool operator==(std::default_sentinel_t) const { return handle.done(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    Generator(Generator &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Generator &operator=(Generator &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Generator(const Generator &) = delete;
+    Generator &operator=(const Generator &) = delete;
+    ~Generator()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    iterator begin()
+    {
+        advance(handle);
+        return iterator{handle};
+    }
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    explicit Generator(std::coroutine_handle<promise_type> generator_handle) : handle(generator_handle) {}
+
+    static void advance(std::coroutine_handle<promise_type> generator_handle)
+    {
+        generator_handle.promise().current_value.reset();
+        generator_handle.resume();
+        if (generator_handle.promise().exception)
+            std::rethrow_exception(generator_handle.promise().exception);
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
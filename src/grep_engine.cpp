@@ -3,13 +3,22 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <memory>
 #include <algorithm>
 #include <stdexcept>
-#include <fstream>
 #include <filesystem>
 #include <string_view>
-#include <windows.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "grep_engine.hpp"
+#include "literal_matcher.hpp"
+#include "token_filter.hpp"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GREP_X86_SIMD 1
+#endif
 namespace fs = std::filesystem;
 
 // ANSI color codes for terminal output
@@ -17,60 +26,16 @@ const std::string COLOR_RED_BOLD = "\033[1;31m";
 const std::string COLOR_RESET = "\033[0m";
 
 // --- Global Profiling Counters ---
-struct NFAProfiler
-{
-    size_t total_steps = 0;
-    size_t total_states_visited = 0;
-    size_t max_active_states = 0;
-    size_t lines_processed = 0;
-
-    void reset()
-    {
-        total_steps = 0;
-        total_states_visited = 0;
-        max_active_states = 0;
-        lines_processed = 0;
-    }
-};
-
-NFAProfiler profiler;
+thread_local NFAProfiler profiler;
 bool enable_profiling = false;
 
-// --- NFA State Definition ---
-struct NFAState
-{
-    std::shared_ptr<NFAState> primary_transition, alternative_transition;
-    int character_code = -1;
-    int last_list_id = -1;
-    std::vector<int> character_set;
-    int capture_group_start = -1;
-    int capture_group_end = -1;
-};
-
-// --- NFA Fragment Definition ---
-struct NFAFragment
-{
-    std::shared_ptr<NFAState> start_state;
-    std::vector<std::shared_ptr<NFAState> *> dangling_outputs;
-};
-
-// --- NFA Opcodes ---
-enum RegexOpcodes
-{
-    OPCODE_SPLIT = 256,
-    OPCODE_MATCH_ANY,
-    OPCODE_MATCH_WORD,
-    OPCODE_MATCH_DIGIT,
-    OPCODE_MATCH_CHOICE,
-    OPCODE_MATCH_ANTI_CHOICE,
-    OPCODE_MATCH_START,
-    OPCODE_MATCH_END,
-    OPCODE_BACKREF_START = 300,
-    OPCODE_MATCHED = 1000
-};
-
 // --- Global Counters ---
 int next_capture_group_id = 1;
+int next_atomic_group_id = 1;
+
+// --- Matching Options ---
+bool multiline_mode = false;
+bool dot_matches_newline = false;
 
 // --- Utility Functions ---
 std::vector<std::string> find_all_files_recursively(fs::path directory_path)
@@ -96,255 +61,367 @@ std::vector<std::string> find_all_files_recursively(fs::path directory_path)
     return found_files;
 }
 
-// Forward declaration
-struct NFAFragment;
-NFAFragment parse_regex(std::string_view &, NFAFragment, int);
-
-// --- NFA Construction ---
-NFAFragment parse_primary_element(std::string_view &regex_pattern)
+void read_stream_contents(std::istream &input, std::string &contents)
 {
-    if (regex_pattern.empty())
+    contents.clear();
+    char chunk[1 << 16];
+    while (input.read(chunk, sizeof(chunk)) || input.gcount() > 0)
     {
-        throw std::runtime_error("Unexpected end of pattern");
+        contents.append(chunk, static_cast<size_t>(input.gcount()));
     }
+}
 
-    auto new_state = std::make_shared<NFAState>();
-    NFAFragment current_fragment{new_state, {&new_state->primary_transition}};
-
-    char current_char = regex_pattern.front();
-    regex_pattern.remove_prefix(1);
-
-    switch (current_char)
-    {
-    case '.':
-        new_state->character_code = OPCODE_MATCH_ANY;
-        break;
-    case '^':
-        new_state->character_code = OPCODE_MATCH_START;
-        break;
-    case '$':
-        new_state->character_code = OPCODE_MATCH_END;
-        break;
-    case '\\':
+// Splits a pattern list on '\n', one pattern per line. A trailing newline
+// ends the last pattern rather than adding an empty one.
+void split_pattern_lines(std::string_view text, std::vector<std::string> &patterns)
+{
+    size_t line_start = 0;
+    while (true)
     {
-        if (regex_pattern.empty())
-            throw std::runtime_error("Unexpected end of pattern after \\");
-        current_char = regex_pattern.front();
-        regex_pattern.remove_prefix(1);
-        if (current_char == 'd')
-            new_state->character_code = OPCODE_MATCH_DIGIT;
-        else if (current_char == 'w')
-            new_state->character_code = OPCODE_MATCH_WORD;
-        else if (isdigit(static_cast<unsigned char>(current_char)))
+        size_t line_end = text.find('\n', line_start);
+        if (line_end == std::string_view::npos)
         {
-            new_state->character_code = OPCODE_BACKREF_START + (current_char - '0');
+            patterns.emplace_back(text.substr(line_start));
+            return;
         }
-        else
-            new_state->character_code = current_char;
-        break;
+        patterns.emplace_back(text.substr(line_start, line_end - line_start));
+        line_start = line_end + 1;
+        if (line_start == text.size())
+            return;
     }
-    case '[':
-    {
-        bool is_negated = false;
-        if (!regex_pattern.empty() && regex_pattern.front() == '^')
-        {
-            is_negated = true;
-            regex_pattern.remove_prefix(1);
-        }
-        new_state->character_code = is_negated ? OPCODE_MATCH_ANTI_CHOICE : OPCODE_MATCH_CHOICE;
+}
 
-        while (!regex_pattern.empty() && regex_pattern.front() != ']')
-        {
-            new_state->character_set.push_back(regex_pattern.front());
-            regex_pattern.remove_prefix(1);
-        }
-        if (regex_pattern.empty())
-            throw std::runtime_error("Unclosed bracket expression");
-        regex_pattern.remove_prefix(1);
-        break;
-    }
-    case '(':
-    {
-        int current_capture_group_id = next_capture_group_id++;
+// --- NFA Construction ---
+// What each pattern byte means to the parser; every other byte is a literal.
+enum PatternToken : uint8_t
+{
+    TOKEN_LITERAL,
+    TOKEN_ANY,
+    TOKEN_LINE_START,
+    TOKEN_LINE_END,
+    TOKEN_ESCAPE,
+    TOKEN_BRACKET,
+    TOKEN_GROUP_OPEN,
+    TOKEN_GROUP_CLOSE,
+    TOKEN_BRACKET_CLOSE,
+    TOKEN_ALTERNATION,
+    TOKEN_STAR,
+    TOKEN_PLUS,
+    TOKEN_QUESTION
+};
 
-        auto capture_start_state = std::make_shared<NFAState>();
-        capture_start_state->character_code = OPCODE_SPLIT;
-        capture_start_state->capture_group_start = current_capture_group_id;
+constexpr std::array<uint8_t, 256> make_pattern_tokens()
+{
+    std::array<uint8_t, 256> tokens{};
+    tokens['.'] = TOKEN_ANY;
+    tokens['^'] = TOKEN_LINE_START;
+    tokens['$'] = TOKEN_LINE_END;
+    tokens['\\'] = TOKEN_ESCAPE;
+    tokens['['] = TOKEN_BRACKET;
+    tokens['('] = TOKEN_GROUP_OPEN;
+    tokens[')'] = TOKEN_GROUP_CLOSE;
+    tokens[']'] = TOKEN_BRACKET_CLOSE;
+    tokens['|'] = TOKEN_ALTERNATION;
+    tokens['*'] = TOKEN_STAR;
+    tokens['+'] = TOKEN_PLUS;
+    tokens['?'] = TOKEN_QUESTION;
+    return tokens;
+}
 
-        NFAFragment inner_fragment = parse_regex(regex_pattern, parse_primary_element(regex_pattern), 0);
+// Opcode of the state an escape \c compiles to, indexed by c.
+constexpr std::array<int, 256> make_escape_opcodes()
+{
+    std::array<int, 256> opcodes{};
+    for (int byte = 0; byte < 256; ++byte)
+        opcodes[byte] = static_cast<char>(byte);
+    for (int digit = 0; digit <= 9; ++digit)
+        opcodes['0' + digit] = OPCODE_BACKREF_START + digit;
+    opcodes['d'] = OPCODE_MATCH_DIGIT;
+    opcodes['w'] = OPCODE_MATCH_WORD;
+    opcodes['s'] = OPCODE_MATCH_SPACE;
+    opcodes['n'] = '\n';
+    opcodes['t'] = '\t';
+    return opcodes;
+}
 
-        if (regex_pattern.empty() || regex_pattern.front() != ')')
-        {
-            throw std::runtime_error("Expected ')' to close group");
-        }
-        regex_pattern.remove_prefix(1);
+constexpr std::array<uint8_t, 256> PATTERN_TOKENS = make_pattern_tokens();
+constexpr std::array<int, 256> ESCAPE_OPCODES = make_escape_opcodes();
 
-        auto capture_end_state = std::make_shared<NFAState>();
-        capture_end_state->character_code = OPCODE_SPLIT;
-        capture_end_state->capture_group_end = current_capture_group_id;
+uint8_t pattern_token(char pattern_char)
+{
+    return PATTERN_TOKENS[static_cast<unsigned char>(pattern_char)];
+}
 
-        capture_start_state->primary_transition = inner_fragment.start_state;
-        for (auto dangling_output : inner_fragment.dangling_outputs)
-        {
-            *dangling_output = capture_end_state;
-        }
+// Allocates states and wires fragments together through patch lists. A
+// deque never moves its elements, so transitions stay valid while it grows.
+struct NFABuilder
+{
+    std::deque<NFAState> states; // In parse order; state_id is the index until the layout pass
+    std::vector<uint32_t> patch_links; // Per slot, the next slot of its patch list
 
-        current_fragment = {capture_start_state, {&capture_end_state->primary_transition}};
-        break;
-    }
-    default:
-        new_state->character_code = current_char;
+    // A new state whose primary, or alternative, transition is left dangling.
+    NFAFragment add_state(int character_code, bool dangling_alternative = false)
+    {
+        uint32_t index = static_cast<uint32_t>(states.size());
+        NFAState &state = states.emplace_back();
+        state.character_code = character_code;
+        state.state_id = static_cast<int>(index);
+        patch_links.resize(states.size() * 2, PatchList::NO_SLOT);
+        uint32_t slot = index * 2 + dangling_alternative;
+        return {&state, {slot, slot}};
     }
 
-    if (!regex_pattern.empty())
+    NFAState *&slot_transition(uint32_t slot)
     {
-        switch (regex_pattern.front())
-        {
-        case '*':
-        {
-            auto split_state = std::make_shared<NFAState>();
-            split_state->character_code = OPCODE_SPLIT;
-            split_state->primary_transition = current_fragment.start_state;
-
-            for (auto dangling_output : current_fragment.dangling_outputs)
-            {
-                *dangling_output = split_state;
-            }
-
-            current_fragment = {split_state, {&split_state->alternative_transition}};
-            regex_pattern.remove_prefix(1);
-        }
-        break;
-        case '+':
-        {
-            auto split_state = std::make_shared<NFAState>();
-            split_state->character_code = OPCODE_SPLIT;
-            split_state->primary_transition = current_fragment.start_state;
-
-            for (auto dangling_output : current_fragment.dangling_outputs)
-            {
-                *dangling_output = split_state;
-            }
-
-            current_fragment.dangling_outputs = {&split_state->alternative_transition};
-            regex_pattern.remove_prefix(1);
-        }
-        break;
-        case '?':
-        {
-            auto split_state = std::make_shared<NFAState>();
-            split_state->character_code = OPCODE_SPLIT;
-            split_state->primary_transition = current_fragment.start_state;
+        NFAState &state = states[slot / 2];
+        return slot % 2 ? state.alternative_transition : state.primary_transition;
+    }
 
-            current_fragment.start_state = split_state;
-            current_fragment.dangling_outputs.push_back(&split_state->alternative_transition);
-            regex_pattern.remove_prefix(1);
-        }
-        break;
-        }
+    void patch(const PatchList &outputs, NFAState *target)
+    {
+        for (uint32_t slot = outputs.first; slot != PatchList::NO_SLOT; slot = patch_links[slot])
+            slot_transition(slot) = target;
     }
 
-    return current_fragment;
-}
+    PatchList join(const PatchList &first, const PatchList &second)
+    {
+        if (first.first == PatchList::NO_SLOT)
+            return second;
+        if (second.first == PatchList::NO_SLOT)
+            return first;
+        patch_links[first.last] = second.first;
+        return {first.first, second.last};
+    }
 
-NFAFragment parse_regex(std::string_view &regex_pattern, NFAFragment left_fragment, int min_precedence)
-{
-    auto get_precedence = [](char operator_char)
+    NFAFragment concatenate(const NFAFragment &left, const NFAFragment &right)
     {
-        if (operator_char == '|')
-            return 0;
-        if (operator_char == ']' || operator_char == ')')
-            return -1;
-        return 1;
-    };
+        if (!left.start_state)
+            return right;
+        patch(left.dangling_outputs, right.start_state);
+        return {left.start_state, right.dangling_outputs};
+    }
 
-    char lookahead_char = !regex_pattern.empty() ? regex_pattern.front() : '\0';
+    NFAFragment alternate(const NFAFragment &left, const NFAFragment &right)
+    {
+        if (!left.start_state)
+            return right;
+        NFAState *split_state = add_state(OPCODE_SPLIT).start_state;
+        split_state->primary_transition = left.start_state;
+        split_state->alternative_transition = right.start_state;
+        return {split_state, join(left.dangling_outputs, right.dangling_outputs)};
+    }
 
-    while (!regex_pattern.empty() && get_precedence(lookahead_char) >= min_precedence)
+    // Brackets inner with atomic group markers: once the backtracking matcher
+    // leaves the group, the alternatives it tried inside are discarded.
+    NFAFragment make_atomic(const NFAFragment &inner)
     {
-        char current_operator = lookahead_char;
+        int atomic_group_id = next_atomic_group_id++;
+        NFAState *atomic_start_state = add_state(OPCODE_SPLIT).start_state;
+        atomic_start_state->atomic_group_start = atomic_group_id;
+        atomic_start_state->primary_transition = inner.start_state;
+
+        NFAFragment atomic_end = add_state(OPCODE_SPLIT);
+        atomic_end.start_state->atomic_group_end = atomic_group_id;
+        patch(inner.dangling_outputs, atomic_end.start_state);
+        return {atomic_start_state, atomic_end.dangling_outputs};
+    }
 
-        if (current_operator == '|')
-        {
-            regex_pattern.remove_prefix(1);
-        }
+    NFAFragment make_capture(const NFAFragment &inner, int capture_group_id)
+    {
+        NFAState *capture_start_state = add_state(OPCODE_SPLIT).start_state;
+        capture_start_state->capture_group_start = capture_group_id;
+        capture_start_state->primary_transition = inner.start_state;
+
+        NFAFragment capture_end = add_state(OPCODE_SPLIT);
+        capture_end.start_state->capture_group_end = capture_group_id;
+        patch(inner.dangling_outputs, capture_end.start_state);
+        return {capture_start_state, capture_end.dangling_outputs};
+    }
 
-        NFAFragment right_fragment = parse_primary_element(regex_pattern);
+    // Applies a *, + or ? following fragment, and a possessive + after it.
+    NFAFragment apply_quantifier(NFAFragment fragment, std::string_view &regex_pattern)
+    {
+        if (regex_pattern.empty())
+            return fragment;
+        uint8_t token = pattern_token(regex_pattern.front());
+        if (token != TOKEN_STAR && token != TOKEN_PLUS && token != TOKEN_QUESTION)
+            return fragment;
+        regex_pattern.remove_prefix(1);
 
-        if (!regex_pattern.empty())
+        NFAFragment split = add_state(OPCODE_SPLIT, true);
+        split.start_state->primary_transition = fragment.start_state;
+        if (token == TOKEN_QUESTION)
         {
-            lookahead_char = regex_pattern.front();
+            fragment = {split.start_state, join(fragment.dangling_outputs, split.dangling_outputs)};
         }
         else
         {
-            lookahead_char = '\0';
+            patch(fragment.dangling_outputs, split.start_state);
+            fragment = {token == TOKEN_STAR ? split.start_state : fragment.start_state, split.dangling_outputs};
         }
 
-        while (!regex_pattern.empty() && get_precedence(lookahead_char) > get_precedence(current_operator))
+        // Possessive quantifiers (*+, ++, ?+) never give back what they matched.
+        if (!regex_pattern.empty() && regex_pattern.front() == '+')
         {
-            right_fragment = parse_regex(regex_pattern, right_fragment, get_precedence(current_operator) + 1);
-            if (regex_pattern.empty())
-                break;
-            lookahead_char = regex_pattern.front();
+            fragment = make_atomic(fragment);
+            regex_pattern.remove_prefix(1);
         }
+        return fragment;
+    }
 
-        if (current_operator == '|')
+    // A single-state element: . ^ $ an escape, a bracket expression or a
+    // literal byte.
+    NFAFragment parse_atom(char current_char, std::string_view &regex_pattern)
+    {
+        switch (pattern_token(current_char))
         {
-            auto split_state = std::make_shared<NFAState>();
-            split_state->character_code = OPCODE_SPLIT;
-            split_state->primary_transition = left_fragment.start_state;
-            split_state->alternative_transition = right_fragment.start_state;
-
-            left_fragment.start_state = split_state;
-            left_fragment.dangling_outputs.insert(left_fragment.dangling_outputs.end(),
-                                                  right_fragment.dangling_outputs.begin(),
-                                                  right_fragment.dangling_outputs.end());
+        case TOKEN_ANY:
+            return add_state(OPCODE_MATCH_ANY);
+        case TOKEN_LINE_START:
+            return add_state(OPCODE_MATCH_START);
+        case TOKEN_LINE_END:
+            return add_state(OPCODE_MATCH_END);
+        case TOKEN_ESCAPE:
+        {
+            if (regex_pattern.empty())
+                throw std::runtime_error("Unexpected end of pattern after \\");
+            int opcode = ESCAPE_OPCODES[static_cast<unsigned char>(regex_pattern.front())];
+            regex_pattern.remove_prefix(1);
+            return add_state(opcode);
         }
-        else
+        case TOKEN_BRACKET:
         {
-            for (auto dangling_output : left_fragment.dangling_outputs)
-            {
-                *dangling_output = right_fragment.start_state;
-            }
-            left_fragment.dangling_outputs = right_fragment.dangling_outputs;
+            bool is_negated = !regex_pattern.empty() && regex_pattern.front() == '^';
+            if (is_negated)
+                regex_pattern.remove_prefix(1);
+            size_t set_length = regex_pattern.find(']');
+            if (set_length == std::string_view::npos)
+                throw std::runtime_error("Unclosed bracket expression");
+            NFAFragment choice = add_state(is_negated ? OPCODE_MATCH_ANTI_CHOICE : OPCODE_MATCH_CHOICE);
+            choice.start_state->character_set.assign(regex_pattern.begin(), regex_pattern.begin() + set_length);
+            regex_pattern.remove_prefix(set_length + 1);
+            return choice;
+        }
+        default:
+            return add_state(current_char);
         }
-
-        if (regex_pattern.empty())
-            break;
-        lookahead_char = regex_pattern.front();
     }
+};
+
+// A group being parsed; the bottom of the stack is the whole pattern.
+struct OpenGroup
+{
+    int capture_group_id = -1; // -1 for atomic groups and the whole pattern
+    bool atomic = false;
+    NFAFragment alternatives; // Alternatives before the last '|', left-nested
+    NFAFragment sequence;     // Concatenation since the last '|'
+};
 
-    return left_fragment;
+// Moves the states reachable from start_state into arena in breadth-first
+// order, so states that are active together sit next to each other, and
+// returns the new start state.
+NFAState *lay_out_nfa_states(NFAState *start_state, size_t parsed_count, NFAArena &arena)
+{
+    std::vector<NFAState *> ordered_states;
+    breadth_first_order(start_state, ordered_states);
+
+    std::vector<uint32_t> new_index(parsed_count);
+    for (size_t index = 0; index < ordered_states.size(); ++index)
+        new_index[ordered_states[index]->state_id] = static_cast<uint32_t>(index);
+
+    arena.states.reserve(ordered_states.size());
+    for (NFAState *parsed_state : ordered_states)
+    {
+        NFAState &state = arena.states.emplace_back(std::move(*parsed_state));
+        state.state_id = static_cast<int>(arena.states.size() - 1);
+        if (state.primary_transition)
+            state.primary_transition = arena.states.data() + new_index[state.primary_transition->state_id];
+        if (state.alternative_transition)
+            state.alternative_transition = arena.states.data() + new_index[state.alternative_transition->state_id];
+    }
+    return arena.states.data();
 }
 
 std::shared_ptr<NFAState> compile_regex_to_nfa(std::string_view regex_string)
 {
-    auto matched_state = std::make_shared<NFAState>();
-    matched_state->character_code = OPCODE_MATCHED;
+    auto arena = std::make_shared<NFAArena>();
+    NFABuilder builder;
+    NFAState *matched_state = builder.add_state(OPCODE_MATCHED).start_state;
 
     if (regex_string.empty())
-        return matched_state;
+        return std::shared_ptr<NFAState>(arena, lay_out_nfa_states(matched_state, builder.states.size(), *arena));
 
-    std::string_view remaining_pattern = regex_string;
+    std::string_view regex_pattern = regex_string;
     next_capture_group_id = 1;
+    next_atomic_group_id = 1;
 
-    NFAFragment complete_fragment = parse_regex(remaining_pattern, parse_primary_element(remaining_pattern), 0);
-
-    if (!remaining_pattern.empty())
+    // Elements are read left to right. Every element is quantified and
+    // appended to the innermost open group; a ')' then closes that group,
+    // which becomes an element of the group around it.
+    std::vector<OpenGroup> open_groups(1);
+    while (true)
     {
-        if (remaining_pattern.front() == ')')
-            throw std::runtime_error("Unmatched ')'");
-        if (remaining_pattern.front() == ']')
-            throw std::runtime_error("Unmatched ']'");
-        throw std::runtime_error("Syntax error in regex");
+        if (regex_pattern.empty())
+            throw std::runtime_error("Unexpected end of pattern");
+        char current_char = regex_pattern.front();
+        regex_pattern.remove_prefix(1);
+
+        if (pattern_token(current_char) == TOKEN_GROUP_OPEN)
+        {
+            OpenGroup group;
+            if (regex_pattern.substr(0, 2) == "?>")
+            {
+                regex_pattern.remove_prefix(2);
+                group.atomic = true;
+            }
+            else
+            {
+                group.capture_group_id = next_capture_group_id++;
+            }
+            open_groups.push_back(group);
+            continue;
+        }
+
+        NFAFragment element = builder.parse_atom(current_char, regex_pattern);
+        uint8_t next_token;
+        while (true)
+        {
+            element = builder.apply_quantifier(element, regex_pattern);
+            OpenGroup &group = open_groups.back();
+            group.sequence = builder.concatenate(group.sequence, element);
+
+            next_token = regex_pattern.empty() ? uint8_t{TOKEN_LITERAL} : pattern_token(regex_pattern.front());
+            if (regex_pattern.empty() || next_token != TOKEN_GROUP_CLOSE || open_groups.size() == 1)
+                break;
+            regex_pattern.remove_prefix(1);
+            NFAFragment inner = builder.alternate(group.alternatives, group.sequence);
+            element = group.atomic ? builder.make_atomic(inner) : builder.make_capture(inner, group.capture_group_id);
+            open_groups.pop_back();
+        }
+
+        if (regex_pattern.empty() || next_token == TOKEN_GROUP_CLOSE || next_token == TOKEN_BRACKET_CLOSE)
+            break;
+        if (next_token == TOKEN_ALTERNATION)
+        {
+            OpenGroup &group = open_groups.back();
+            group.alternatives = builder.alternate(group.alternatives, group.sequence);
+            group.sequence = {};
+            regex_pattern.remove_prefix(1);
+        }
     }
 
-    for (auto dangling_output : complete_fragment.dangling_outputs)
+    if (open_groups.size() > 1)
+        throw std::runtime_error(open_groups.back().atomic ? "Expected ')' to close atomic group" : "Expected ')' to close group");
+    if (!regex_pattern.empty())
     {
-        *dangling_output = matched_state;
+        if (regex_pattern.front() == ')')
+            throw std::runtime_error("Unmatched ')'");
+        throw std::runtime_error("Unmatched ']'");
     }
 
-    return complete_fragment.start_state;
+    NFAFragment complete_fragment = builder.alternate(open_groups.back().alternatives, open_groups.back().sequence);
+    builder.patch(complete_fragment.dangling_outputs, matched_state);
+    return std::shared_ptr<NFAState>(arena, lay_out_nfa_states(complete_fragment.start_state, builder.states.size(), *arena));
 }
 
 // --- NFA Simulation with Captures ---
@@ -366,7 +443,7 @@ struct CaptureGroupInfo
 
 struct ActiveNFAState
 {
-    std::shared_ptr<NFAState> nfa_state;
+    NFAState *nfa_state;
     CaptureGroupInfo capture_info;
 
     bool operator<(const ActiveNFAState &other) const
@@ -379,52 +456,184 @@ struct ActiveNFAState
 
 using ActiveStateList = std::vector<ActiveNFAState>;
 
+// Zero-width facts about the position an epsilon closure is computed at,
+// used to resolve the ^ and $ assertions.
+struct PositionContext
+{
+    bool at_line_start = true;
+    bool at_line_end = true;
+};
+
+PositionContext context_at(std::string_view text, size_t position)
+{
+    return {position == 0 || text[position - 1] == '\n',
+            position == text.size() || text[position] == '\n'};
+}
+
 bool has_matching_state(const ActiveStateList &active_states)
 {
     return std::any_of(active_states.begin(), active_states.end(), [](const ActiveNFAState &state)
                        { return state.nfa_state->character_code == OPCODE_MATCHED; });
 }
 
-void add_state_with_epsilon_closure(std::shared_ptr<NFAState> state_to_add,
-                                    CaptureGroupInfo capture_info,
-                                    ActiveStateList &active_states,
-                                    std::set<std::shared_ptr<NFAState>> &visited_states)
+// A capture marker passed on the way into a state, applied in path order.
+struct CaptureEffect
 {
-    if (!state_to_add || visited_states.count(state_to_add))
-        return;
-    visited_states.insert(state_to_add);
+    int group_id;
+    bool starts_group;
+};
 
-    if (state_to_add->capture_group_start >= 0)
+// The epsilon closure of one state at one kind of position: the states a
+// thread entering it ends up in, in the order the simulator adds them, each
+// with the capture markers on its path. Splits and assertions are resolved
+// away; an assertion that fails at the position cuts its path.
+struct EpsilonClosure
+{
+    struct Entry
     {
-        int group_id = state_to_add->capture_group_start;
-        capture_info.captured_text[group_id].clear();
-        capture_info.is_actively_capturing[group_id] = true;
-    }
-    if (state_to_add->capture_group_end >= 0)
+        NFAState *state;
+        uint32_t first_effect;
+        uint32_t effect_count;
+    };
+    std::vector<Entry> entries;
+    std::vector<CaptureEffect> effects;
+};
+
+// Walks the closure depth first with an explicit stack, primary transition
+// before alternative, so deep alternations cannot exhaust the call stack.
+// A state is entered once, by the first path to reach it.
+void compute_epsilon_closure(NFAState *start_state, const PositionContext &context, EpsilonClosure &closure)
+{
+    struct PendingState
     {
-        int group_id = state_to_add->capture_group_end;
-        capture_info.is_actively_capturing[group_id] = false;
+        NFAState *state;
+        size_t path_effect_count; // Markers on the path up to its predecessor
+    };
+    std::vector<PendingState> stack;
+    std::vector<CaptureEffect> path_effects;
+    std::vector<bool> visited;
+    if (start_state)
+        stack.push_back({start_state, 0});
+    while (!stack.empty())
+    {
+        PendingState pending = stack.back();
+        stack.pop_back();
+        NFAState *state = pending.state;
+        size_t id = static_cast<size_t>(state->state_id);
+        if (id >= visited.size())
+            visited.resize(std::max(id + 1, visited.size() * 2));
+        if (visited[id])
+            continue;
+        visited[id] = true;
+
+        path_effects.resize(pending.path_effect_count);
+        if (state->capture_group_start >= 0)
+            path_effects.push_back({state->capture_group_start, true});
+        if (state->capture_group_end >= 0)
+            path_effects.push_back({state->capture_group_end, false});
+
+        NFAState *next_states[2] = {nullptr, nullptr};
+        if (state->character_code == OPCODE_SPLIT)
+        {
+            next_states[0] = state->primary_transition;
+            next_states[1] = state->alternative_transition;
+        }
+        else if (state->character_code == OPCODE_MATCH_START || state->character_code == OPCODE_MATCH_END)
+        {
+            // Assertions are epsilon transitions that only exist where they hold.
+            bool holds = state->character_code == OPCODE_MATCH_START ? context.at_line_start : context.at_line_end;
+            next_states[0] = holds ? state->primary_transition : nullptr;
+        }
+        else
+        {
+            closure.entries.push_back({state, static_cast<uint32_t>(closure.effects.size()), static_cast<uint32_t>(path_effects.size())});
+            closure.effects.insert(closure.effects.end(), path_effects.begin(), path_effects.end());
+            continue;
+        }
+        for (int i = 1; i >= 0; --i)
+            if (next_states[i])
+                stack.push_back({next_states[i], path_effects.size()});
     }
+}
 
-    if (state_to_add->character_code == OPCODE_SPLIT)
+// Closures computed on first use, one per state and position context, so a
+// step appends a stored list instead of walking splits again.
+class EpsilonClosureCache
+{
+public:
+    const EpsilonClosure &closure_of(NFAState *state, const PositionContext &context)
     {
-        add_state_with_epsilon_closure(state_to_add->primary_transition, capture_info, active_states, visited_states);
-        add_state_with_epsilon_closure(state_to_add->alternative_transition, capture_info, active_states, visited_states);
-        return;
+        if (!state)
+            return empty_closure;
+        size_t key = static_cast<size_t>(state->state_id) * 4 + context.at_line_start * 2 + context.at_line_end;
+        if (key >= closures.size())
+            closures.resize(std::max(key + 1, closures.size() * 2));
+        if (!closures[key])
+        {
+            closures[key] = std::make_unique<EpsilonClosure>();
+            compute_epsilon_closure(state, context, *closures[key]);
+        }
+        return *closures[key];
     }
 
-    active_states.push_back({state_to_add, capture_info});
+private:
+    std::vector<std::unique_ptr<EpsilonClosure>> closures; // Indexed by state_id * 4 + context bits
+    EpsilonClosure empty_closure;
+};
+
+// Adds a thread with capture_info for every state of closure.
+void add_epsilon_closure(const EpsilonClosure &closure, const CaptureGroupInfo &capture_info, ActiveStateList &active_states)
+{
+    for (const EpsilonClosure::Entry &entry : closure.entries)
+    {
+        active_states.push_back({entry.state, capture_info});
+        CaptureGroupInfo &entry_capture_info = active_states.back().capture_info;
+        for (uint32_t i = 0; i < entry.effect_count; ++i)
+        {
+            const CaptureEffect &effect = closure.effects[entry.first_effect + i];
+            if (effect.starts_group)
+                entry_capture_info.captured_text[effect.group_id].clear();
+            entry_capture_info.is_actively_capturing[effect.group_id] = effect.starts_group;
+        }
+    }
 }
 
-void initialize_active_states(std::shared_ptr<NFAState> start_state, ActiveStateList &active_states)
+void initialize_active_states(NFAState *start_state, ActiveStateList &active_states, EpsilonClosureCache &closures,
+                              const PositionContext &context)
 {
     active_states.clear();
-    std::set<std::shared_ptr<NFAState>> visited_states;
-    CaptureGroupInfo initial_capture_info{};
-    add_state_with_epsilon_closure(start_state, initial_capture_info, active_states, visited_states);
+    add_epsilon_closure(closures.closure_of(start_state, context), CaptureGroupInfo{}, active_states);
 }
 
-void process_character_step(ActiveStateList &current_states, char input_char, ActiveStateList &next_states)
+// Whether a consuming state accepts input_char. Non-consuming opcodes
+// (split, anchors, backreferences, matched) never accept a character, and
+// '\n' is only consumable in multiline mode.
+bool state_accepts_character(const NFAState &nfa_state, char input_char)
+{
+    if (input_char == '\n' && !multiline_mode)
+        return false;
+
+    switch (nfa_state.character_code)
+    {
+    case OPCODE_MATCH_ANY:
+        return input_char != '\n' || dot_matches_newline;
+    case OPCODE_MATCH_SPACE:
+        return isspace(static_cast<unsigned char>(input_char));
+    case OPCODE_MATCH_DIGIT:
+        return isdigit(static_cast<unsigned char>(input_char));
+    case OPCODE_MATCH_WORD:
+        return isalnum(static_cast<unsigned char>(input_char)) || input_char == '_';
+    case OPCODE_MATCH_CHOICE:
+        return std::find(nfa_state.character_set.begin(), nfa_state.character_set.end(), input_char) != nfa_state.character_set.end();
+    case OPCODE_MATCH_ANTI_CHOICE:
+        return std::find(nfa_state.character_set.begin(), nfa_state.character_set.end(), input_char) == nfa_state.character_set.end();
+    default:
+        return nfa_state.character_code == input_char;
+    }
+}
+
+void process_character_step(ActiveStateList &current_states, char input_char, ActiveStateList &next_states,
+                            EpsilonClosureCache &closures, const PositionContext &next_context)
 {
     next_states.clear();
     profiler.total_steps++; // Count each step
@@ -434,40 +643,13 @@ void process_character_step(ActiveStateList &current_states, char input_char, Ac
         auto nfa_state = active_state.nfa_state;
         auto capture_info = active_state.capture_info;
 
-        bool can_consume_character = false;
-        bool character_added_by_backref = false;
-
-        switch (nfa_state->character_code)
-        {
-        case OPCODE_MATCH_ANY:
-            can_consume_character = true;
-            break;
-        case OPCODE_MATCH_DIGIT:
-            can_consume_character = isdigit(static_cast<unsigned char>(input_char));
-            break;
-        case OPCODE_MATCH_WORD:
-            can_consume_character = (isalnum(static_cast<unsigned char>(input_char)) || input_char == '_');
-            break;
-        case OPCODE_MATCH_CHOICE:
-            can_consume_character = (std::find(nfa_state->character_set.begin(), nfa_state->character_set.end(), input_char) != nfa_state->character_set.end());
-            break;
-        case OPCODE_MATCH_ANTI_CHOICE:
-            can_consume_character = (std::find(nfa_state->character_set.begin(), nfa_state->character_set.end(), input_char) == nfa_state->character_set.end());
-            break;
-        default:
-            if (nfa_state->character_code == input_char)
-                can_consume_character = true;
-            break;
-        }
-
-        if (can_consume_character)
+        if (state_accepts_character(*nfa_state, input_char))
         {
             for (auto &[group_id, is_active] : capture_info.is_actively_capturing)
                 if (is_active)
                     capture_info.captured_text[group_id].push_back(input_char);
 
-            std::set<std::shared_ptr<NFAState>> visited_states;
-            add_state_with_epsilon_closure(nfa_state->primary_transition, capture_info, next_states, visited_states);
+            add_epsilon_closure(closures.closure_of(nfa_state->primary_transition, next_context), capture_info, next_states);
         }
     }
 
@@ -475,19 +657,28 @@ void process_character_step(ActiveStateList &current_states, char input_char, Ac
     profiler.max_active_states = std::max(profiler.max_active_states, current_states.size());
 }
 
-// --- MatchInfo + Matching Functions ---
-struct MatchInfo
+size_t run_nfa_simulation(std::shared_ptr<NFAState> nfa_start_state, std::string_view text)
 {
-    bool found;
-    std::vector<std::pair<size_t, size_t>> matches; // Each pair is {start_pos, end_pos}
-};
+    ActiveStateList current_states, next_states;
+    EpsilonClosureCache closures;
+    initialize_active_states(nfa_start_state.get(), current_states, closures, context_at(text, 0));
+    size_t position = 0;
+    while (position < text.size() && !current_states.empty())
+    {
+        process_character_step(current_states, text[position], next_states, closures, context_at(text, position + 1));
+        current_states.swap(next_states);
+        position++;
+    }
+    return position;
+}
 
+// --- Matching Functions ---
 MatchInfo match_text_with_positions(std::shared_ptr<NFAState> nfa_start_state, std::string_view original_input_text)
 {
     MatchInfo result_info = {false, {}};
-    profiler.lines_processed++;
 
     size_t current_global_pos = 0; // Tracks our position in the original_input_text
+    EpsilonClosureCache closures;
 
     // Loop to find all non-overlapping matches
     while (current_global_pos <= original_input_text.size())
@@ -496,7 +687,7 @@ MatchInfo match_text_with_positions(std::shared_ptr<NFAState> nfa_start_state, s
         std::string_view remaining_text = original_input_text.substr(current_global_pos);
 
         ActiveStateList current_states, next_states;
-        initialize_active_states(nfa_start_state, current_states);
+        initialize_active_states(nfa_start_state.get(), current_states, closures, context_at(original_input_text, current_global_pos));
 
         bool match_found_in_this_segment = false;
         size_t match_length = 0; // To store the length of the match found
@@ -511,11 +702,12 @@ MatchInfo match_text_with_positions(std::shared_ptr<NFAState> nfa_start_state, s
                 break; // Found the shortest match in this segment
             }
 
-            if (i == remaining_text.size())
-                break; // Reached end of remaining text
+            if (i == remaining_text.size() || current_states.empty())
+                break; // Reached end of remaining text, or no thread can still match
 
             // Pass the character from remaining_text
-            process_character_step(current_states, remaining_text[i], next_states);
+            process_character_step(current_states, remaining_text[i], next_states, closures,
+                                   context_at(original_input_text, current_global_pos + i + 1));
             current_states.swap(next_states);
         }
 
@@ -544,135 +736,674 @@ MatchInfo match_text_with_positions(std::shared_ptr<NFAState> nfa_start_state, s
     return result_info;
 }
 
-// --- Output ---
-void print_with_color(const std::string &line, const MatchInfo &match_info, bool use_color)
+// --- Lazy DFA ---
+#if defined(__GNUC__) || defined(__clang__)
+#define GREP_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define GREP_PREFETCH(address) ((void)0)
+#endif
+
+void breadth_first_order(NFAState *start_state, std::vector<NFAState *> &ordered_states)
 {
-    if (!use_color || !match_info.found)
+    // 0-1 BFS: epsilon successors go on a stack that is drained first, so a
+    // closure is placed as one run; consuming successors wait in a FIFO for
+    // the next level. A state is placed when it is first taken off either.
+    ordered_states.clear();
+    std::vector<bool> placed;
+    std::vector<NFAState *> closure_stack = {start_state};
+    std::vector<NFAState *> next_level;
+    size_t next_level_head = 0;
+    while (!closure_stack.empty() || next_level_head < next_level.size())
     {
-        std::cout << line << '\n';
-        return;
+        NFAState *state;
+        if (!closure_stack.empty())
+        {
+            state = closure_stack.back();
+            closure_stack.pop_back();
+        }
+        else
+        {
+            state = next_level[next_level_head++];
+        }
+        size_t id = static_cast<size_t>(state->state_id);
+        if (id >= placed.size())
+            placed.resize(std::max(id + 1, placed.size() * 2));
+        if (placed[id])
+            continue;
+        placed[id] = true;
+        ordered_states.push_back(state);
+
+        if (state->character_code == OPCODE_SPLIT)
+        {
+            if (state->alternative_transition)
+                closure_stack.push_back(state->alternative_transition);
+            if (state->primary_transition)
+                closure_stack.push_back(state->primary_transition);
+        }
+        else if (state->primary_transition)
+        {
+            bool is_assertion = state->character_code == OPCODE_MATCH_START || state->character_code == OPCODE_MATCH_END;
+            if (is_assertion)
+                closure_stack.push_back(state->primary_transition);
+            else
+                next_level.push_back(state->primary_transition);
+        }
     }
+}
 
-    size_t current_pos = 0;
-    for (const auto &match_pair : match_info.matches)
+void number_nfa_states(std::shared_ptr<NFAState> start_state, std::vector<NFAState *> &numbered_states)
+{
+    breadth_first_order(start_state.get(), numbered_states);
+    for (size_t index = 0; index < numbered_states.size(); ++index)
+        numbered_states[index]->state_id = static_cast<int>(index);
+}
+
+// Appends the ids of all states reachable from state through split and
+// satisfied ^ transitions; $ states are kept as pending members. visited is
+// shared across calls so a subset is built without duplicates.
+void collect_epsilon_closure(NFAState *state, std::vector<int> &closure, std::vector<bool> &visited, bool at_line_start)
+{
+    std::vector<NFAState *> pending_states = {state};
+    while (!pending_states.empty())
     {
-        size_t match_start = match_pair.first;
-        size_t match_end = match_pair.second;
+        NFAState *current = pending_states.back();
+        pending_states.pop_back();
+        if (!current || visited[current->state_id])
+            continue;
+        visited[current->state_id] = true;
 
-        // Print text before the current match
-        std::cout << line.substr(current_pos, match_start - current_pos);
+        if (current->character_code == OPCODE_SPLIT)
+        {
+            pending_states.push_back(current->alternative_transition);
+            pending_states.push_back(current->primary_transition);
+            continue;
+        }
+        if (current->character_code == OPCODE_MATCH_START)
+        {
+            if (at_line_start)
+                pending_states.push_back(current->primary_transition);
+            continue;
+        }
+        closure.push_back(current->state_id);
+    }
+}
 
-        // Print the matched text in color
-        std::cout << COLOR_RED_BOLD
-                  << line.substr(match_start, match_end - match_start)
-                  << COLOR_RESET;
+// Follows every pending $ in state_ids as if the current position were a line
+// end, appending what becomes reachable. Returns true if a match is reached.
+bool expand_line_end_assertions(const LazyDFA &dfa, std::vector<int> &state_ids, std::vector<bool> &visited, bool at_line_start)
+{
+    for (size_t i = 0; i < state_ids.size(); ++i)
+    {
+        const NFAState *state = dfa.nfa_states[state_ids[i]];
+        if (state->character_code == OPCODE_MATCH_END)
+            collect_epsilon_closure(state->primary_transition, state_ids, visited, at_line_start);
+    }
+    return std::any_of(state_ids.begin(), state_ids.end(), [&](int state_id)
+                       { return dfa.nfa_states[state_id]->character_code == OPCODE_MATCHED; });
+}
 
-        current_pos = match_end; // Update current position to after the match
+bool nfa_uses_backreferences(const std::vector<NFAState *> &nfa_states)
+{
+    return std::any_of(nfa_states.begin(), nfa_states.end(), [](const NFAState *state)
+                       { return state->character_code >= OPCODE_BACKREF_START && state->character_code < OPCODE_MATCHED; });
+}
+
+void compute_byte_classes(LazyDFA &dfa)
+{
+    dfa.byte_class.fill(0);
+    dfa.class_count = 1;
+
+    // Refine the partition once per consuming state: bytes stay together only
+    // if every state accepts all of them or none of them. '\n' always gets a
+    // class of its own since it drives the line assertions.
+    auto refine = [&](auto &&in_subset)
+    {
+        std::array<int, 512> refined_class;
+        refined_class.fill(-1);
+        uint32_t refined_count = 0;
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            int key = dfa.byte_class[byte] * 2 + (in_subset(byte) ? 1 : 0);
+            if (refined_class[key] < 0)
+                refined_class[key] = static_cast<int>(refined_count++);
+            dfa.byte_class[byte] = static_cast<uint8_t>(refined_class[key]);
+        }
+        dfa.class_count = refined_count;
+    };
+
+    refine([](int byte)
+           { return byte == '\n'; });
+    // States that test the same bytes refine the partition the same way, and
+    // large alternations repeat the same few literals many times over.
+    std::set<std::pair<int, std::vector<int>>> refined_tests;
+    for (const NFAState *state : dfa.nfa_states)
+    {
+        if (state->character_code == OPCODE_SPLIT || !refined_tests.insert({state->character_code, state->character_set}).second)
+            continue;
+        refine([&](int byte)
+               { return state_accepts_character(*state, static_cast<char>(byte)); });
     }
-    // Print any remaining text after the last match
-    std::cout << line.substr(current_pos) << '\n';
+
+    dfa.class_representative.assign(dfa.class_count, 0);
+    for (int byte = 255; byte >= 0; --byte)
+        dfa.class_representative[dfa.byte_class[byte]] = static_cast<unsigned char>(byte);
+}
+
+uint32_t intern_dfa_state(LazyDFA &dfa, std::vector<int> &&state_key)
+{
+    auto existing = dfa.state_lookup.find(state_key);
+    if (existing != dfa.state_lookup.end())
+        return existing->second;
+
+    std::vector<int> state_ids(state_key.begin() + 1, state_key.end());
+    std::vector<bool> visited(dfa.nfa_states.size(), false);
+    for (int state_id : state_ids)
+        visited[state_id] = true;
+    bool matches_at_end = expand_line_end_assertions(dfa, state_ids, visited, state_key[0] & LazyDFA::LINE_START_FLAG);
+
+    uint32_t row = dfa.row_of(static_cast<uint32_t>(dfa.state_keys.size()));
+    dfa.transitions.resize(dfa.transitions.size() + dfa.class_count, dfa.row_of(LazyDFA::UNKNOWN_STATE));
+    dfa.matches_at_text_end.push_back(matches_at_end);
+    dfa.state_lookup.emplace(state_key, row);
+    dfa.state_keys.push_back(std::move(state_key));
+    profiler.dfa_states_built++;
+    return row;
+}
+
+int start_key_flags(const LazyDFA &dfa, bool unanchored, bool at_line_start)
+{
+    return (unanchored ? LazyDFA::UNANCHORED_FLAG : 0) |
+           (at_line_start && dfa.uses_line_assertions ? LazyDFA::LINE_START_FLAG : 0);
 }
 
-// --- Main ---
-int main(int argc, char *argv[])
+std::vector<int> make_start_key(const LazyDFA &dfa, int flags)
 {
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
+    std::vector<int> start_key = {flags};
+    const std::vector<int> &closure = dfa.start_closure[(flags & LazyDFA::LINE_START_FLAG) ? 1 : 0];
+    start_key.insert(start_key.end(), closure.begin(), closure.end());
+    return start_key;
+}
 
-    bool use_recursive_search = false;
-    bool use_color = true;
-    std::string regex_pattern_string;
-    std::vector<std::string> target_files;
+void reset_dfa_cache(LazyDFA &dfa)
+{
+    dfa.transitions.assign(dfa.row_of(LazyDFA::ACCELERATED_START_STATE), dfa.row_of(LazyDFA::UNKNOWN_STATE));
+    dfa.state_keys.assign(LazyDFA::ACCELERATED_START_STATE, {});
+    dfa.matches_at_text_end.assign(LazyDFA::ACCELERATED_START_STATE, false);
+    dfa.state_lookup.clear();
+    std::fill(std::begin(dfa.start_rows), std::end(dfa.start_rows), dfa.row_of(LazyDFA::UNKNOWN_STATE));
+
+    // The mid-line unanchored start is interned first so it lands on the
+    // reserved row: returning to it leaves the unrolled loop and lets the skip
+    // loop jump ahead.
+    if (dfa.accelerate_start)
+    {
+        int flags = start_key_flags(dfa, true, false);
+        dfa.start_rows[flags] = intern_dfa_state(dfa, make_start_key(dfa, flags));
+    }
+}
+
+uint32_t dfa_start_row(LazyDFA &dfa, int flags)
+{
+    if (dfa.start_rows[flags] == dfa.row_of(LazyDFA::UNKNOWN_STATE))
+        dfa.start_rows[flags] = intern_dfa_state(dfa, make_start_key(dfa, flags));
+    return dfa.start_rows[flags];
+}
+
+// Builds (and caches) the transition out of row on class_index. Building may
+// reset the cache, which invalidates every row offset and table pointer the
+// caller holds except the returned one.
+uint32_t compute_dfa_transition(LazyDFA &dfa, uint32_t row, uint32_t class_index)
+{
+    std::vector<int> source_key = dfa.state_keys[row / dfa.class_count];
+    int source_flags = source_key[0];
+    char input_char = static_cast<char>(dfa.class_representative[class_index]);
+    bool reads_newline = input_char == '\n';
+
+    std::vector<int> current_ids(source_key.begin() + 1, source_key.end());
+    uint32_t target_row = dfa.row_of(LazyDFA::UNKNOWN_STATE);
+    if (reads_newline)
+    {
+        std::vector<bool> expanded(dfa.nfa_states.size(), false);
+        for (int state_id : current_ids)
+            expanded[state_id] = true;
+        if (expand_line_end_assertions(dfa, current_ids, expanded, source_flags & LazyDFA::LINE_START_FLAG))
+            target_row = dfa.row_of(LazyDFA::MATCH_BEFORE_STATE);
+    }
 
-    for (int i = 1; i < argc; i++)
+    if (target_row == dfa.row_of(LazyDFA::UNKNOWN_STATE))
     {
-        std::string arg = argv[i];
+        bool next_at_line_start = reads_newline && dfa.uses_line_assertions;
+        std::vector<int> target_key = {(source_flags & LazyDFA::UNANCHORED_FLAG) | (next_at_line_start ? LazyDFA::LINE_START_FLAG : 0)};
+        std::vector<bool> visited(dfa.nfa_states.size(), false);
+        for (int state_id : current_ids)
+        {
+            const NFAState *state = dfa.nfa_states[state_id];
+            if (state_accepts_character(*state, input_char))
+                collect_epsilon_closure(state->primary_transition, target_key, visited, next_at_line_start);
+        }
 
-        if (arg == "-E")
+        bool reaches_match = std::any_of(target_key.begin() + 1, target_key.end(), [&](int state_id)
+                                         { return dfa.nfa_states[state_id]->character_code == OPCODE_MATCHED; });
+        if (reaches_match)
         {
-            if (i + 1 < argc)
+            target_row = dfa.row_of(LazyDFA::MATCH_STATE);
+        }
+        else
+        {
+            if (source_flags & LazyDFA::UNANCHORED_FLAG)
             {
-                regex_pattern_string = argv[++i];
+                for (int state_id : dfa.start_closure[next_at_line_start ? 1 : 0])
+                    if (!visited[state_id])
+                        target_key.push_back(state_id);
+            }
+
+            // An unanchored state never dies: with no thread alive (say, past
+            // the ^ of an anchored pattern) it waits for the next line start.
+            if (target_key.size() == 1 && !(source_flags & LazyDFA::UNANCHORED_FLAG))
+            {
+                target_row = dfa.row_of(LazyDFA::DEAD_STATE);
             }
             else
             {
-                std::cerr << "Error: -E requires a pattern.\n";
-                return 1;
+                std::sort(target_key.begin() + 1, target_key.end());
+                if (dfa.state_keys.size() >= LazyDFA::MAX_CACHED_STATES)
+                {
+                    reset_dfa_cache(dfa);
+                    profiler.dfa_cache_resets++;
+                    row = intern_dfa_state(dfa, std::move(source_key));
+                }
+                target_row = intern_dfa_state(dfa, std::move(target_key));
             }
         }
-        else if (arg == "-r")
+    }
+
+    dfa.transitions[row + class_index] = target_row;
+    return target_row;
+}
+
+LazyDFA build_lazy_dfa(std::shared_ptr<NFAState> nfa_start_state)
+{
+    LazyDFA dfa;
+    dfa.nfa_start_state = nfa_start_state.get();
+    number_nfa_states(nfa_start_state, dfa.nfa_states);
+    dfa.uses_line_assertions = std::any_of(dfa.nfa_states.begin(), dfa.nfa_states.end(), [](const NFAState *state)
+                                           { return state->character_code == OPCODE_MATCH_START || state->character_code == OPCODE_MATCH_END; });
+    compute_byte_classes(dfa);
+
+    for (int at_line_start = 0; at_line_start < 2; ++at_line_start)
+    {
+        std::vector<int> &closure = dfa.start_closure[at_line_start];
+        std::vector<bool> visited(dfa.nfa_states.size(), false);
+        collect_epsilon_closure(dfa.nfa_start_state, closure, visited, at_line_start);
+        std::sort(closure.begin(), closure.end());
+        dfa.start_matches_empty[at_line_start] = std::any_of(closure.begin(), closure.end(), [&](int state_id)
+                                                             { return dfa.nfa_states[state_id]->character_code == OPCODE_MATCHED; });
+    }
+
+    // A position is worth an anchored attempt if its byte can be consumed from
+    // a start closure, or if it is a '\n' that may satisfy a pending $. Bytes
+    // of one class are accepted by the same states, so one byte per class is
+    // tested against the closures.
+    std::vector<uint8_t> class_accepted[2];
+    for (int at_line_start = 0; at_line_start < 2; ++at_line_start)
+    {
+        class_accepted[at_line_start].assign(dfa.class_count, 0);
+        for (int state_id : dfa.start_closure[at_line_start])
         {
-            use_recursive_search = true;
+            for (uint32_t class_index = 0; class_index < dfa.class_count; ++class_index)
+            {
+                if (!class_accepted[at_line_start][class_index])
+                    class_accepted[at_line_start][class_index] =
+                        state_accepts_character(*dfa.nfa_states[state_id], static_cast<char>(dfa.class_representative[class_index]));
+            }
         }
-        else if (arg.find("--color=") == 0)
+    }
+    size_t leave_byte_count = 0;
+    for (int byte = 0; byte < 256; ++byte)
+    {
+        uint8_t class_index = dfa.byte_class[byte];
+        bool is_line_break = byte == '\n' && dfa.uses_line_assertions;
+        dfa.can_begin_match[byte] = class_accepted[0][class_index] || class_accepted[1][class_index] || is_line_break;
+        dfa.can_leave_start[byte] = class_accepted[0][class_index] || is_line_break;
+        if (dfa.can_leave_start[byte])
         {
-            std::string opt = arg.substr(8);
-            use_color = (opt != "never");
+            leave_byte_count++;
+            dfa.single_begin_byte = byte;
         }
-        else if (arg == "--profile")
+    }
+    if (leave_byte_count != 1)
+        dfa.single_begin_byte = -1;
+
+    dfa.accelerate_start = leave_byte_count <= LazyDFA::MAX_ACCELERATED_BEGIN_BYTES;
+    dfa.first_normal_row = dfa.row_of(LazyDFA::ACCELERATED_START_STATE + (dfa.accelerate_start ? 1 : 0));
+    reset_dfa_cache(dfa);
+    return dfa;
+}
+
+// Skip loop for the start state: returns the first position at or after
+// cursor holding a byte flagged in candidates.
+const unsigned char *skip_to_candidate(const std::array<bool, 256> &candidates, int single_byte,
+                                       const unsigned char *cursor, const unsigned char *text_end)
+{
+    if (single_byte >= 0)
+    {
+        const void *candidate = std::memchr(cursor, single_byte, text_end - cursor);
+        return candidate ? static_cast<const unsigned char *>(candidate) : text_end;
+    }
+    while (cursor < text_end && !candidates[*cursor])
+        ++cursor;
+    return cursor;
+}
+
+// Runs the DFA over text from position and returns the end offset of the
+// shortest match found, or npos if the text ends or the DFA dies first.
+// Unanchored runs restart the pattern at every position, so they find the
+// earliest match end anywhere in the text. Bytes passed over by the start
+// state's skip loop are added to skipped_bytes.
+size_t run_lazy_dfa(LazyDFA &dfa, bool unanchored, std::string_view text, size_t position, size_t &skipped_bytes)
+{
+    PositionContext context = context_at(text, position);
+    if (dfa.start_matches_empty[context.at_line_start ? 1 : 0])
+        return position;
+
+    const unsigned char *text_begin = reinterpret_cast<const unsigned char *>(text.data());
+    const unsigned char *text_end = text_begin + text.size();
+    const unsigned char *cursor = text_begin + position;
+    const uint8_t *byte_class = dfa.byte_class.data();
+    const uint32_t first_normal_row = dfa.first_normal_row;
+    const uint32_t unknown_row = dfa.row_of(LazyDFA::UNKNOWN_STATE);
+    const uint32_t dead_row = dfa.row_of(LazyDFA::DEAD_STATE);
+    const uint32_t match_row = dfa.row_of(LazyDFA::MATCH_STATE);
+    const uint32_t match_before_row = dfa.row_of(LazyDFA::MATCH_BEFORE_STATE);
+    uint32_t row = dfa_start_row(dfa, start_key_flags(dfa, unanchored, context.at_line_start));
+    const uint32_t *table = dfa.transitions.data();
+
+    while (true)
+    {
+        // The only special row the loop can sit in is the accelerated start.
+        if (row < first_normal_row)
         {
-            enable_profiling = true;
+            const unsigned char *candidate = skip_to_candidate(dfa.can_leave_start, dfa.single_begin_byte, cursor, text_end);
+            skipped_bytes += static_cast<size_t>(candidate - cursor);
+            cursor = candidate;
         }
-        else
+
+        // Unrolled fast path: only a special row (unknown, dead, a match or the
+        // accelerated start) falls through to the single-byte step below.
+        while (text_end - cursor >= 4)
+        {
+            GREP_PREFETCH(cursor + LazyDFA::PREFETCH_DISTANCE);
+            uint32_t row0 = table[row + byte_class[cursor[0]]];
+            if (row0 < first_normal_row)
+                break;
+            uint32_t row1 = table[row0 + byte_class[cursor[1]]];
+            if (row1 < first_normal_row)
+            {
+                row = row0;
+                cursor += 1;
+                break;
+            }
+            uint32_t row2 = table[row1 + byte_class[cursor[2]]];
+            if (row2 < first_normal_row)
+            {
+                row = row1;
+                cursor += 2;
+                break;
+            }
+            uint32_t row3 = table[row2 + byte_class[cursor[3]]];
+            if (row3 < first_normal_row)
+            {
+                row = row2;
+                cursor += 3;
+                break;
+            }
+            row = row3;
+            cursor += 4;
+        }
+
+        if (cursor == text_end)
+            return dfa.matches_at_text_end[row / dfa.class_count] ? text.size() : std::string_view::npos;
+
+        uint32_t next_row = table[row + byte_class[*cursor]];
+        if (next_row == unknown_row)
         {
-            target_files.push_back(arg);
+            next_row = compute_dfa_transition(dfa, row, byte_class[*cursor]);
+            table = dfa.transitions.data();
         }
+
+        if (next_row == match_before_row)
+            return static_cast<size_t>(cursor - text_begin);
+        ++cursor;
+        if (next_row == match_row)
+            return static_cast<size_t>(cursor - text_begin);
+        if (next_row == dead_row)
+            return std::string_view::npos;
+        row = next_row;
     }
+}
 
-    std::shared_ptr<NFAState> nfa;
-    try
+MatchInfo match_text_with_dfa(LazyDFA &dfa, std::string_view text)
+{
+    MatchInfo result_info = {false, {}};
+
+    const unsigned char *text_begin = reinterpret_cast<const unsigned char *>(text.data());
+    const unsigned char *text_end = text_begin + text.size();
+    bool can_skip = !dfa.start_matches_empty[0] && !dfa.start_matches_empty[1];
+
+    size_t search_from = 0;
+    while (search_from <= text.size())
+    {
+        // An unanchored pass finds the earliest match end in linear time, so
+        // text without matches is never searched position by position.
+        size_t earliest_match_end = run_lazy_dfa(dfa, true, text, search_from, result_info.prefilter_skipped_bytes);
+        if (earliest_match_end == std::string_view::npos)
+            break;
+
+        // The leftmost match starts no later than earliest_match_end; try the
+        // candidate positions up to there for the leftmost-shortest span.
+        // These runs rescan text the unanchored pass already covered, so
+        // what they skip is not counted again.
+        size_t candidate_pos = search_from;
+        size_t match_end = std::string_view::npos;
+        size_t rescan_skipped_bytes = 0;
+        while (candidate_pos <= earliest_match_end)
+        {
+            if (can_skip)
+                candidate_pos = skip_to_candidate(dfa.can_begin_match, -1, text_begin + candidate_pos, text_end) - text_begin;
+
+            match_end = run_lazy_dfa(dfa, false, text, candidate_pos, rescan_skipped_bytes);
+            if (match_end != std::string_view::npos)
+                break;
+            candidate_pos++;
+        }
+        if (match_end == std::string_view::npos)
+            break;
+
+        result_info.found = true;
+        result_info.matches.push_back({candidate_pos, match_end});
+        search_from = candidate_pos + std::max((size_t)1, match_end - candidate_pos);
+    }
+
+    return result_info;
+}
+
+MatchInfo match_text_with_literals(const LiteralAutomaton &automaton, std::string_view text)
+{
+    MatchInfo result_info = {false, {}};
+
+    size_t search_from = 0;
+    while (search_from <= text.size())
+    {
+        size_t match_end = 0;
+        size_t match_start = find_leftmost_literal(automaton, text, search_from, match_end, result_info.prefilter_skipped_bytes);
+        if (match_start == std::string_view::npos)
+            break;
+
+        result_info.found = true;
+        result_info.matches.push_back({match_start, match_end});
+        search_from = match_start + std::max((size_t)1, match_end - match_start);
+    }
+
+    return result_info;
+}
+
+MatchInfo match_text_with_token_filter(const TokenFilter &filter, const TokenDelimiters &delimiters, std::string_view text)
+{
+    MatchInfo result_info = {false, {}};
+    for_each_filtered_token(filter, delimiters, text, [&](size_t token_start, size_t token_end)
+                            { result_info.matches.push_back({token_start, token_end}); });
+    result_info.found = !result_info.matches.empty();
+    return result_info;
+}
+
+// --- Output ---
+void print_with_color(std::string_view line, const MatchInfo &match_info, bool use_color, std::ostream &out)
+{
+    if (!use_color || !match_info.found)
     {
-        nfa = compile_regex_to_nfa(regex_pattern_string);
+        out << line << '\n';
+        return;
     }
-    catch (const std::exception &e)
+
+    size_t current_pos = 0;
+    for (const auto &match_pair : match_info.matches)
     {
-        std::cerr << "Regex error: " << e.what() << '\n';
-        return 1;
+        size_t match_start = match_pair.first;
+        size_t match_end = match_pair.second;
+
+        // Print text before the current match
+        out << line.substr(current_pos, match_start - current_pos);
+
+        // Print the matched text in color
+        out << COLOR_RED_BOLD
+            << line.substr(match_start, match_end - match_start)
+            << COLOR_RESET;
+
+        current_pos = match_end; // Update current position to after the match
     }
+    // Print any remaining text after the last match
+    out << line.substr(current_pos) << '\n';
+}
 
-    bool found_any = false;
+size_t line_start_at(std::string_view buffer, size_t position)
+{
+    if (position == 0)
+        return 0;
+    size_t previous_newline = buffer.rfind('\n', position - 1);
+    return previous_newline == std::string_view::npos ? 0 : previous_newline + 1;
+}
+
+size_t line_end_at(std::string_view buffer, size_t position)
+{
+    size_t next_newline = buffer.find('\n', position);
+    return next_newline == std::string_view::npos ? buffer.size() : next_newline;
+}
 
-    if (target_files.empty())
+// --- Line Numbers ---
+size_t count_newlines_scalar(const char *begin, const char *end)
+{
+    return static_cast<size_t>(std::count(begin, end, '\n'));
+}
+
+#if defined(GREP_X86_SIMD)
+__attribute__((target("avx2,popcnt"))) size_t count_newlines_avx2(const char *begin, const char *end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t newline_count = 0;
+    while (end - begin >= 32)
     {
-        std::string line;
-        while (std::getline(std::cin, line))
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+        uint32_t newline_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+        newline_count += _mm_popcnt_u32(newline_mask);
+        begin += 32;
+    }
+    return newline_count + count_newlines_scalar(begin, end);
+}
+
+// SSE2 is always available on x86-64. Compare results (0 or -1 per byte) are
+// subtracted into byte counters, which are widened with psadbw before they
+// can overflow, so no popcount instruction is needed.
+size_t count_newlines_sse2(const char *begin, const char *end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t newline_count = 0;
+    while (end - begin >= 16)
+    {
+        __m128i byte_counts = _mm_setzero_si128();
+        for (int round = 0; round < 255 && end - begin >= 16; ++round)
         {
-            MatchInfo mi = match_text_with_positions(nfa, line);
-            if (mi.found)
-            {
-                print_with_color(line, mi, use_color);
-                found_any = true;
-            }
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+            byte_counts = _mm_sub_epi8(byte_counts, _mm_cmpeq_epi8(block, newline));
+            begin += 16;
         }
+        __m128i lane_sums = _mm_sad_epu8(byte_counts, _mm_setzero_si128());
+        newline_count += static_cast<size_t>(_mm_cvtsi128_si32(lane_sums)) +
+                         static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(lane_sums, 8)));
     }
-    else
+    return newline_count + count_newlines_scalar(begin, end);
+}
+#endif
+
+size_t count_newlines(const char *begin, const char *end)
+{
+#if defined(GREP_X86_SIMD)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    return has_avx2 ? count_newlines_avx2(begin, end) : count_newlines_sse2(begin, end);
+#else
+    return count_newlines_scalar(begin, end);
+#endif
+}
+
+// Prints every line touched by a match once, coloring the matched spans and
+// prefixing each line with file_prefix and, when line_counter is given, its
+// number. Matches are buffer offsets; a multiline match pulls in all the
+// lines it covers and later matches starting inside those lines join the
+// same block.
+void print_matching_lines(std::string_view buffer, const MatchInfo &match_info, bool use_color, LineCounter *line_counter,
+                          std::string_view file_prefix, std::ostream &out)
+{
+    const auto &matches = match_info.matches;
+    size_t match_index = 0;
+    while (match_index < matches.size())
     {
-        for (const auto &f : target_files)
+        size_t block_start = line_start_at(buffer, matches[match_index].first);
+        size_t block_end = block_start;
+        size_t block_first_match = match_index;
+
+        while (match_index < matches.size() && (match_index == block_first_match || matches[match_index].first <= block_end))
         {
-            std::ifstream fin(f);
-            if (!fin.is_open())
-                continue;
-            std::string line;
-            while (std::getline(fin, line))
+            auto [match_start, match_end] = matches[match_index];
+            size_t last_byte = match_end > match_start ? match_end - 1 : match_start;
+            block_end = std::max(block_end, line_end_at(buffer, last_byte));
+            match_index++;
+        }
+
+        // Print the block line by line so colors and line numbers restart
+        // on every line. Spans are clipped to each line; an empty match is
+        // kept on the line it sits in.
+        size_t line_start = block_start;
+        while (true)
+        {
+            size_t line_end = std::min(line_end_at(buffer, line_start), block_end);
+            MatchInfo line_info = {true, {}};
+            for (size_t i = block_first_match; i < match_index; ++i)
             {
-                MatchInfo mi = match_text_with_positions(nfa, line);
-                if (mi.found)
-                {
-                    print_with_color(line, mi, use_color);
-                    found_any = true;
-                }
+                auto [match_start, match_end] = matches[i];
+                size_t clipped_start = std::max(match_start, line_start);
+                size_t clipped_end = std::min(match_end, line_end);
+                if (match_start == match_end ? (match_start >= line_start && match_start <= line_end)
+                                             : clipped_start < clipped_end)
+                    line_info.matches.push_back({clipped_start - line_start, clipped_end - line_start});
             }
-        }
-    }
 
-    if (enable_profiling)
-    {
-        std::cerr << "\n[Regex Profiler Summary]\n"
-                  << "  Lines processed      : " << profiler.lines_processed << "\n"
-                  << "  Total simulation steps: " << profiler.total_steps << "\n"
-                  << "  Total states visited : " << profiler.total_states_visited << "\n"
-                  << "  Max active states     : " << profiler.max_active_states << "\n";
-    }
+            out << file_prefix;
+            if (line_counter)
+                out << line_counter->line_number_at(buffer, line_start) << ':';
+            print_with_color(buffer.substr(line_start, line_end - line_start), line_info, use_color, out);
 
-    return !found_any;
-}
\ No newline at end of file
+            if (line_end >= block_end)
+                break;
+            line_start = line_end + 1;
+        }
+    }
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "literal_matcher.hpp"
+#include "token_filter.hpp"
+
+// --- Global Profiling Counters ---
+struct NFAProfiler
+{
+    size_t total_steps = 0;
+    size_t total_states_visited = 0;
+    size_t max_active_states = 0;
+    size_t lines_processed = 0;
+    size_t dfa_states_built = 0;
+    size_t dfa_cache_resets = 0;
+
+    void reset()
+    {
+        total_steps = 0;
+        total_states_visited = 0;
+        max_active_states = 0;
+        lines_processed = 0;
+        dfa_states_built = 0;
+        dfa_cache_resets = 0;
+    }
+
+    void merge(const NFAProfiler &other)
+    {
+        total_steps += other.total_steps;
+        total_states_visited += other.total_states_visited;
+        max_active_states = std::max(max_active_states, other.max_active_states);
+        lines_processed += other.lines_processed;
+        dfa_states_built += other.dfa_states_built;
+        dfa_cache_resets += other.dfa_cache_resets;
+    }
+};
+
+// Per thread; parallel searches merge their counters into the main thread's.
+extern thread_local NFAProfiler profiler;
+extern bool enable_profiling;
+
+// --- NFA State Definition ---
+// Exactly one cache line, so walking a state list touches one line per state.
+struct alignas(64) NFAState
+{
+    NFAState *primary_transition = nullptr, *alternative_transition = nullptr; // States of the same NFAArena
+    int character_code = -1;
+    int capture_group_start = -1;
+    int capture_group_end = -1;
+    int atomic_group_start = -1; // Set on the split markers around (?>...) and possessive quantifiers
+    int atomic_group_end = -1;
+    int state_id = -1; // Dense index assigned by number_nfa_states()
+    std::vector<int> character_set;
+};
+
+// --- NFA Arena ---
+// Owns every state of one compiled NFA, stored contiguously in breadth-first
+// order from the start state (see number_nfa_states), with state_id equal to
+// the index. compile_regex_to_nfa returns a shared_ptr to the start state that
+// shares ownership of the whole arena.
+struct NFAArena
+{
+    std::vector<NFAState> states;
+};
+
+// --- NFA Fragment Definition ---
+// Dangling outputs are a linked list of transition slots: slot 2 * i is the
+// primary and slot 2 * i + 1 the alternative transition of parsed state i,
+// and the compiler keeps the link to the next slot of each list. Joining two
+// lists is O(1), so no fragment ever copies its outputs.
+struct PatchList
+{
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    uint32_t first = NO_SLOT;
+    uint32_t last = NO_SLOT;
+};
+
+struct NFAFragment
+{
+    NFAState *start_state = nullptr; // Null for an empty fragment
+    PatchList dangling_outputs;
+};
+
+// --- NFA Opcodes ---
+enum RegexOpcodes
+{
+    OPCODE_SPLIT = 256,
+    OPCODE_MATCH_ANY,
+    OPCODE_MATCH_WORD,
+    OPCODE_MATCH_DIGIT,
+    OPCODE_MATCH_CHOICE,
+    OPCODE_MATCH_ANTI_CHOICE,
+    OPCODE_MATCH_START,
+    OPCODE_MATCH_END,
+    OPCODE_MATCH_SPACE,
+    OPCODE_BACKREF_START = 300,
+    OPCODE_MATCHED = 1000
+};
+
+// --- Matching Options ---
+extern bool multiline_mode;      // -U: matches may span lines
+extern bool dot_matches_newline; // --multiline-dotall: '.' also matches '\n'
+
+// --- Match Results ---
+struct MatchInfo
+{
+    bool found;
+    std::vector<std::pair<size_t, size_t>> matches; // Each pair is {start_pos, end_pos}
+    bool interrupted = false;                       // A deadline stopped the search; matches cover a prefix of the text
+    size_t prefilter_skipped_bytes = 0;             // Bytes a skip loop passed over without running the engine
+};
+
+// --- Lazy DFA ---
+// Subset-construction DFA built on demand while scanning. Bytes are folded into
+// equivalence classes and transition entries hold premultiplied row offsets
+// (state index * class_count), so the scan loop never multiplies. Rows below
+// first_normal_row are special (unknown, dead, the two match states and, when
+// accelerated, the unanchored start), which lets the loop detect all of them
+// with one compare.
+//
+// ^ is resolved while building closures because the previous byte is known.
+// $ states stay pending in the state set and are expanded when the next byte
+// turns out to be '\n' (a match ending before that byte) or the text ends.
+struct LazyDFA
+{
+    static constexpr uint32_t UNKNOWN_STATE = 0;
+    static constexpr uint32_t DEAD_STATE = 1;
+    static constexpr uint32_t MATCH_STATE = 2;        // Match ends after the byte just read
+    static constexpr uint32_t MATCH_BEFORE_STATE = 3; // Match ended before the byte just read
+    static constexpr uint32_t ACCELERATED_START_STATE = 4;
+    static constexpr size_t MAX_CACHED_STATES = 10000;
+    static constexpr size_t MAX_ACCELERATED_BEGIN_BYTES = 16;
+    static constexpr size_t PREFETCH_DISTANCE = 256;
+
+    // State key flags, stored in key[0].
+    static constexpr int UNANCHORED_FLAG = 1;
+    static constexpr int LINE_START_FLAG = 2;
+
+    std::vector<NFAState *> nfa_states; // Indexed by NFAState::state_id
+    NFAState *nfa_start_state = nullptr;
+    bool uses_line_assertions = false;
+    std::vector<int> start_closure[2]; // Sorted closure ids, indexed by at_line_start
+    bool start_matches_empty[2] = {false, false};
+
+    std::array<uint8_t, 256> byte_class{};
+    std::vector<unsigned char> class_representative;
+    uint32_t class_count = 0;
+
+    std::array<bool, 256> can_begin_match{}; // Any context; drives the anchored skip loop
+    std::array<bool, 256> can_leave_start{}; // Mid-line unanchored start only
+    int single_begin_byte = -1;
+    bool accelerate_start = false;
+    uint32_t first_normal_row = 0;
+
+    // State keys are {flags, sorted NFA ids...}; unanchored states always
+    // contain the start closure so a match may begin at any position.
+    std::vector<uint32_t> transitions;
+    std::vector<std::vector<int>> state_keys;
+    std::vector<uint8_t> matches_at_text_end; // Per state: pending $ reaches a match at the end
+    std::map<std::vector<int>, uint32_t> state_lookup;
+    uint32_t start_rows[4] = {0, 0, 0, 0}; // Indexed by key flags
+
+    uint32_t row_of(uint32_t state_index) const { return state_index * class_count; }
+};
+
+// --- Engine API ---
+// Parses regex_string into a Thompson NFA. Throws std::runtime_error on
+// syntax errors. The parser keeps open groups on an explicit stack, so
+// neither nesting depth nor pattern length is limited by the call stack.
+std::shared_ptr<NFAState> compile_regex_to_nfa(std::string_view regex_string);
+
+bool state_accepts_character(const NFAState &nfa_state, char input_char);
+// Lists the states reachable from start_state breadth first, with epsilon
+// transitions taken before consuming ones: the start closure comes first, and
+// every later closure follows the states whose bytes lead into it. Requires
+// state_id to be a dense index, as it is in a compiled NFA.
+void breadth_first_order(NFAState *start_state, std::vector<NFAState *> &ordered_states);
+void number_nfa_states(std::shared_ptr<NFAState> start_state, std::vector<NFAState *> &numbered_states);
+bool nfa_uses_backreferences(const std::vector<NFAState *> &nfa_states);
+
+LazyDFA build_lazy_dfa(std::shared_ptr<NFAState> nfa_start_state);
+int start_key_flags(const LazyDFA &dfa, bool unanchored, bool at_line_start);
+uint32_t dfa_start_row(LazyDFA &dfa, int flags);
+uint32_t compute_dfa_transition(LazyDFA &dfa, uint32_t row, uint32_t class_index);
+
+MatchInfo match_text_with_positions(std::shared_ptr<NFAState> nfa_start_state, std::string_view original_input_text);
+MatchInfo match_text_with_dfa(LazyDFA &dfa, std::string_view text);
+MatchInfo match_text_with_literals(const LiteralAutomaton &automaton, std::string_view text);
+MatchInfo match_text_with_token_filter(const TokenFilter &filter, const TokenDelimiters &delimiters, std::string_view text);
+
+// Runs the NFA simulation anchored at the start of text, without the restart
+// loop and match bookkeeping of match_text_with_positions, until the state
+// set empties or text ends. Returns the bytes consumed. Lets benchmarks time
+// the per-byte step and epsilon closure on their own.
+size_t run_nfa_simulation(std::shared_ptr<NFAState> nfa_start_state, std::string_view text);
+
+// --- Input and Output ---
+// Reads everything left in input into contents.
+void read_stream_contents(std::istream &input, std::string &contents);
+void split_pattern_lines(std::string_view text, std::vector<std::string> &patterns);
+
+size_t count_newlines(const char *begin, const char *end);
+
+// Computes line numbers on demand for one buffer. Requests must come in
+// increasing position order; only the bytes since the previous request are
+// scanned, so a selective search counts little more than it prints.
+struct LineCounter
+{
+    size_t counted_up_to = 0; // Buffer offset line_number was computed for
+    size_t line_number = 1;
+
+    size_t line_number_at(std::string_view buffer, size_t position)
+    {
+        line_number += count_newlines(buffer.data() + counted_up_to, buffer.data() + position);
+        counted_up_to = position;
+        return line_number;
+    }
+};
+
+void print_with_color(std::string_view line, const MatchInfo &match_info, bool use_color, std::ostream &out);
+void print_matching_lines(std::string_view buffer, const MatchInfo &match_info, bool use_color, LineCounter *line_counter,
+                          std::string_view file_prefix, std::ostream &out);
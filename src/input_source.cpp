@@ -0,0 +1,583 @@
+#include "input_source.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include "io_uring.hpp"
+#include "page_cache.hpp"
+#include "read_ahead.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_POSIX_IO 1
+#endif
+
+namespace
+{
+    const std::array<const char *, INPUT_BACKEND_COUNT> BACKEND_NAMES = {"auto", "mmap", "pread", "read-ahead", "io-uring", "stream"};
+
+    // Reusable BLOCK_SIZE buffers, so a search of many small files does not
+    // allocate (and fault in) a fresh buffer for each.
+    class BufferPool
+    {
+    public:
+        static constexpr size_t MAX_POOLED_BUFFERS = 64;
+
+        std::unique_ptr<char[]> acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                if (!free_buffers.empty())
+                {
+                    std::unique_ptr<char[]> buffer = std::move(free_buffers.back());
+                    free_buffers.pop_back();
+                    return buffer;
+                }
+            }
+            return std::make_unique_for_overwrite<char[]>(InputSource::BLOCK_SIZE);
+        }
+
+        void release(std::unique_ptr<char[]> buffer)
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (buffer && free_buffers.size() < MAX_POOLED_BUFFERS)
+                free_buffers.push_back(std::move(buffer));
+        }
+
+    private:
+        std::mutex pool_mutex;
+        std::vector<std::unique_ptr<char[]>> free_buffers;
+    };
+
+    BufferPool &block_buffers()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // A pooled buffer, handed back when the source is done with it.
+    struct PooledBuffer
+    {
+        std::unique_ptr<char[]> data = block_buffers().acquire();
+
+        PooledBuffer() = default;
+        PooledBuffer(const PooledBuffer &) = delete;
+        PooledBuffer &operator=(const PooledBuffer &) = delete;
+        ~PooledBuffer() { block_buffers().release(std::move(data)); }
+
+        char *get() const { return data.get(); }
+    };
+
+    class ReadAheadSource : public InputSource
+    {
+    public:
+        explicit ReadAheadSource(const std::string &path) : InputSource(INPUT_BACKEND_READ_AHEAD), reader(path) {}
+
+        bool is_open() const { return reader.is_open(); }
+        std::string_view next_block() override { return reader.next_block(); }
+
+    private:
+        ReadAheadReader reader;
+    };
+
+#if defined(GREP_HAS_POSIX_IO)
+    // An open descriptor; standard input is borrowed rather than owned.
+    struct FileDescriptor
+    {
+        int fd = -1;
+        bool owned = true;
+
+        FileDescriptor(int fd, bool owned) : fd(fd), owned(owned) {}
+        FileDescriptor(const FileDescriptor &) = delete;
+        FileDescriptor &operator=(const FileDescriptor &) = delete;
+        ~FileDescriptor()
+        {
+            if (owned && fd >= 0)
+                close(fd);
+        }
+    };
+
+    // Maps the whole file and hands it out in MAPPED_BLOCK_SIZE views, so
+    // blocks reach the matcher without being copied. As with any mapped
+    // read, a file truncated during the search raises SIGBUS.
+    class MappedSource : public InputSource
+    {
+    public:
+        MappedSource(int fd, size_t offset, size_t file_size) : InputSource(INPUT_BACKEND_MMAP)
+        {
+            if (file_size == 0)
+                return;
+            void *address = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
+                return;
+#if defined(MADV_SEQUENTIAL)
+            madvise(address, file_size, MADV_SEQUENTIAL);
+#endif
+            mapping = static_cast<const char *>(address);
+            mapping_size = file_size;
+            position = std::min(offset, file_size);
+        }
+
+        ~MappedSource() override
+        {
+            if (mapping)
+                munmap(const_cast<char *>(mapping), mapping_size);
+        }
+
+        bool is_open() const { return mapping != nullptr; }
+
+        std::string_view next_block() override
+        {
+            size_t length = std::min(MAPPED_BLOCK_SIZE, mapping_size - position);
+            std::string_view block(mapping + position, length);
+            position += length;
+            return block;
+        }
+
+    private:
+        const char *mapping = nullptr;
+        size_t mapping_size = 0;
+        size_t position = 0;
+    };
+
+    size_t read_retrying(int fd, char *destination, size_t length, const size_t *offset)
+    {
+        while (true)
+        {
+            ssize_t received = offset ? pread(fd, destination, length, static_cast<off_t>(*offset)) : read(fd, destination, length);
+            if (received >= 0)
+                return static_cast<size_t>(received);
+            if (errno != EINTR)
+                return 0;
+        }
+    }
+
+    // Reads BLOCK_SIZE blocks at explicit offsets into a pooled buffer. A
+    // file below the block size takes a single pread; the known size saves
+    // the call that would only report the end.
+    class PreadSource : public InputSource
+    {
+    public:
+        PreadSource(int fd, bool owned, size_t offset, size_t file_size)
+            : InputSource(INPUT_BACKEND_PREAD), file(fd, owned), position(offset),
+              // Files such as those in /proc report no size but have content.
+              end_position(file_size > 0 ? file_size : SIZE_MAX)
+        {
+        }
+
+        std::string_view next_block() override
+        {
+            if (position >= end_position)
+                return {};
+            size_t length = read_retrying(file.fd, buffer.get(), std::min(BLOCK_SIZE, end_position - position), &position);
+            position = length > 0 ? position + length : end_position;
+            return {buffer.get(), length};
+        }
+
+    private:
+        FileDescriptor file;
+        PooledBuffer buffer;
+        size_t position;
+        size_t end_position;
+    };
+
+    // A range that selected nothing.
+    class EmptySource : public InputSource
+    {
+    public:
+        EmptySource() : InputSource(INPUT_BACKEND_PREAD) {}
+
+        std::string_view next_block() override { return {}; }
+    };
+
+    // Plain reads for pipes, terminals and devices. Each read returns what
+    // has arrived, so an interactive pipe is searched as it goes.
+    class StreamSource : public InputSource
+    {
+    public:
+        StreamSource(int fd, bool owned) : InputSource(INPUT_BACKEND_STREAM), file(fd, owned) {}
+
+        std::string_view next_block() override
+        {
+            size_t length = read_retrying(file.fd, buffer.get(), BLOCK_SIZE, nullptr);
+            return {buffer.get(), length};
+        }
+
+    private:
+        FileDescriptor file;
+        PooledBuffer buffer;
+    };
+
+    // Keeps QUEUE_DEPTH block reads in flight on a private ring. The caller
+    // holds one block while the kernel fills the others, and each block it
+    // gives back is queued again for the next offset.
+    class IoUringSource : public InputSource
+    {
+    public:
+        static constexpr size_t QUEUE_DEPTH = 4;
+
+        IoUringSource(int fd, bool owned, size_t offset, size_t file_size)
+            : InputSource(INPUT_BACKEND_IO_URING), file(fd, owned), ring(QUEUE_DEPTH), next_offset(offset),
+              // As for PreadSource, a reported size of 0 means read to the end.
+              end_offset(file_size > 0 ? file_size : SIZE_MAX)
+        {
+            if (!ring.is_open())
+                return;
+            for (size_t index = 0; index < QUEUE_DEPTH; ++index)
+                submit(index);
+        }
+
+        ~IoUringSource() override
+        {
+            // The kernel may still be writing into the buffers.
+            for (Slot &slot : slots)
+            {
+                while (slot.in_flight && !slot.completed && wait_one())
+                {
+                }
+            }
+        }
+
+        bool is_open() const { return ring.is_open() && (slots[0].in_flight || next_offset >= end_offset); }
+        void adopt_descriptor() { file.owned = true; }
+
+        std::string_view next_block() override
+        {
+            if (holding_slot)
+            {
+                submit(next_take);
+                next_take = (next_take + 1) % QUEUE_DEPTH;
+                holding_slot = false;
+            }
+            Slot &slot = slots[next_take];
+            while (slot.in_flight && !slot.completed)
+            {
+                if (!wait_one())
+                    return {};
+            }
+            if (!slot.in_flight || slot.result <= 0)
+                return {};
+
+            // A short read is finished synchronously rather than reordering
+            // the queue.
+            size_t length = static_cast<size_t>(slot.result);
+            while (length < slot.length)
+            {
+                size_t offset = slot.offset + length;
+                size_t received = read_retrying(file.fd, slot.buffer.get() + length, slot.length - length, &offset);
+                if (received == 0)
+                    break;
+                length += received;
+            }
+            slot.in_flight = false;
+            holding_slot = true;
+            return {slot.buffer.get(), length};
+        }
+
+    private:
+        struct Slot
+        {
+            PooledBuffer buffer;
+            size_t offset = 0;
+            size_t length = 0;
+            int result = 0;
+            bool in_flight = false;
+            bool completed = false;
+        };
+
+        void submit(size_t index)
+        {
+            Slot &slot = slots[index];
+            slot.in_flight = slot.completed = false;
+            if (next_offset >= end_offset)
+                return;
+            slot.offset = next_offset;
+            slot.length = std::min(BLOCK_SIZE, end_offset - next_offset);
+            if (!ring.submit_read(file.fd, slot.buffer.get(), slot.length, slot.offset, index))
+                return;
+            slot.in_flight = true;
+            next_offset += slot.length;
+        }
+
+        bool wait_one()
+        {
+            uint64_t index = 0;
+            int result = 0;
+            if (!ring.wait_completion(index, result) || index >= QUEUE_DEPTH)
+                return false;
+            slots[index].completed = true;
+            slots[index].result = result;
+            return true;
+        }
+
+        FileDescriptor file;
+        IoUring ring;
+        Slot slots[QUEUE_DEPTH];
+        size_t next_offset;
+        size_t end_offset;
+        size_t next_take = 0;
+        bool holding_slot = false;
+    };
+
+    // Picks the backend for bytes [begin, end) of a regular file. Small
+    // ranges are read in one pread. Larger ones are mapped when the page
+    // cache already holds them, since then a mapping costs no I/O at all;
+    // otherwise the reads are overlapped with matching.
+    InputBackend choose_file_backend(int fd, size_t begin, size_t end, InputBackend requested, bool have_path)
+    {
+        bool usable = requested != INPUT_BACKEND_AUTO &&
+                      (requested != INPUT_BACKEND_IO_URING || IoUring::available()) &&
+                      (requested != INPUT_BACKEND_READ_AHEAD || have_path);
+        if (usable)
+            return requested;
+        if (end - begin < InputSource::LARGE_FILE_SIZE)
+            return INPUT_BACKEND_PREAD;
+        if (pages_resident(fd, begin, end))
+            return INPUT_BACKEND_MMAP;
+        if (IoUring::available())
+            return INPUT_BACKEND_IO_URING;
+        return have_path ? INPUT_BACKEND_READ_AHEAD : INPUT_BACKEND_MMAP;
+    }
+
+    // Opens the regular file fd with backend, falling back to pread when a
+    // mapping or ring cannot be set up.
+    std::unique_ptr<InputSource> open_regular_file(int fd, bool owned, const std::string *path, size_t offset, size_t file_size,
+                                                   InputBackend backend)
+    {
+        switch (backend)
+        {
+        case INPUT_BACKEND_MMAP:
+        {
+            auto source = std::make_unique<MappedSource>(fd, offset, file_size);
+            if (source->is_open())
+            {
+                if (owned)
+                    close(fd);
+                return source;
+            }
+            break;
+        }
+        case INPUT_BACKEND_READ_AHEAD:
+        {
+            auto source = std::make_unique<ReadAheadSource>(*path);
+            if (source->is_open())
+            {
+                if (owned)
+                    close(fd);
+                return source;
+            }
+            break;
+        }
+        case INPUT_BACKEND_IO_URING:
+        {
+            // The descriptor is only handed over once the ring works, so a
+            // failed attempt leaves it open for pread.
+            auto source = std::make_unique<IoUringSource>(fd, false, offset, file_size);
+            if (source->is_open())
+            {
+                if (owned)
+                    source->adopt_descriptor();
+                return source;
+            }
+            break;
+        }
+        case INPUT_BACKEND_STREAM:
+            return std::make_unique<StreamSource>(fd, owned);
+        default:
+            break;
+        }
+        return std::make_unique<PreadSource>(fd, owned, offset, file_size);
+    }
+#else
+    // Without POSIX I/O, standard input is read through the stream buffer,
+    // only as far as data has arrived.
+    class IstreamSource : public InputSource
+    {
+    public:
+        explicit IstreamSource(std::istream &input) : InputSource(INPUT_BACKEND_STREAM), source(input.rdbuf()), buffer(BLOCK_SIZE, '\0') {}
+
+        std::string_view next_block() override
+        {
+            if (source->in_avail() <= 0 && source->sgetc() == std::char_traits<char>::eof())
+                return {};
+            size_t request = std::min<size_t>(BLOCK_SIZE, std::max<std::streamsize>(1, source->in_avail()));
+            size_t received = source->sgetn(buffer.data(), request);
+            return {buffer.data(), received};
+        }
+
+    private:
+        std::streambuf *source;
+        std::string buffer;
+    };
+#endif
+}
+
+bool parse_input_backend(std::string_view name, InputBackend &backend)
+{
+    for (int index = 0; index < INPUT_BACKEND_COUNT; ++index)
+    {
+        if (name == BACKEND_NAMES[index])
+        {
+            backend = static_cast<InputBackend>(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *input_backend_name(InputBackend backend)
+{
+    return BACKEND_NAMES[backend];
+}
+
+std::unique_ptr<InputSource> open_input_source(const std::string &path, InputBackend backend)
+{
+#if defined(GREP_HAS_POSIX_IO)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    if (!S_ISREG(file_status.st_mode))
+        return std::make_unique<StreamSource>(fd, true);
+    size_t file_size = static_cast<size_t>(file_status.st_size);
+    return open_regular_file(fd, true, &path, 0, file_size, choose_file_backend(fd, 0, file_size, backend, true));
+#else
+    (void)backend;
+    auto source = std::make_unique<ReadAheadSource>(path);
+    if (!source->is_open())
+        return nullptr;
+    return source;
+#endif
+}
+
+std::unique_ptr<InputSource> open_input_range(const std::string &path, InputBackend backend, const ByteRangeSelector &select_range)
+{
+#if defined(GREP_HAS_POSIX_IO)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    size_t file_size = static_cast<size_t>(file_status.st_size);
+    void *mapping = S_ISREG(file_status.st_mode) && file_size > 0 ? mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (mapping == MAP_FAILED)
+    {
+        close(fd);
+        if (file_size > 0 || !S_ISREG(file_status.st_mode))
+            std::cerr << "Warning: " << path << ": cannot be mapped to select a range, searching all of it\n";
+        return open_input_source(path, backend);
+    }
+
+    // Selecting a range touches a few scattered pages, not the whole file.
+#if defined(MADV_RANDOM)
+    madvise(mapping, file_size, MADV_RANDOM);
+#endif
+    auto [begin, end] = select_range(std::string_view(static_cast<const char *>(mapping), file_size));
+    munmap(mapping, file_size);
+    end = std::min(end, file_size);
+    if (begin >= end)
+    {
+        close(fd);
+        return std::make_unique<EmptySource>();
+    }
+
+    // Read-ahead and streaming read from the start of the file, so a range
+    // goes to a backend that reads at offsets.
+    InputBackend chosen = choose_file_backend(fd, begin, end, backend, true);
+    if (chosen == INPUT_BACKEND_READ_AHEAD || chosen == INPUT_BACKEND_STREAM)
+        chosen = IoUring::available() ? INPUT_BACKEND_IO_URING : INPUT_BACKEND_PREAD;
+    return open_regular_file(fd, true, &path, begin, end, chosen);
+#else
+    (void)select_range;
+    std::cerr << "Warning: " << path << ": ranges cannot be selected on this platform, searching all of it\n";
+    return open_input_source(path, backend);
+#endif
+}
+
+FileAppend append_file_contents(const std::string &path, size_t max_size, std::string &buffer)
+{
+    size_t start = buffer.size();
+#if defined(GREP_HAS_POSIX_IO)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return FILE_APPEND_FAILED;
+    // The size also sizes the first read. Files such as those in /proc
+    // report none and are read to their end.
+    struct stat file_status;
+    size_t file_size = fstat(fd, &file_status) == 0 ? static_cast<size_t>(file_status.st_size) : 0;
+    if (file_size >= max_size)
+    {
+        close(fd);
+        return FILE_APPEND_TOO_LARGE;
+    }
+    size_t room = file_size > 0 ? file_size + 1 : 4096;
+    size_t used = start;
+    bool read_ok = true;
+    while (true)
+    {
+        buffer.resize(used + room);
+        ssize_t received = read(fd, buffer.data() + used, room);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+        {
+            read_ok = received == 0;
+            break;
+        }
+        used += static_cast<size_t>(received);
+        room = std::max<size_t>(room - static_cast<size_t>(received), 4096);
+    }
+    close(fd);
+    buffer.resize(read_ok ? used : start);
+    return read_ok ? FILE_APPEND_DONE : FILE_APPEND_FAILED;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return FILE_APPEND_FAILED;
+    if (static_cast<size_t>(file.tellg()) >= max_size)
+        return FILE_APPEND_TOO_LARGE;
+    file.seekg(0);
+    buffer.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file.bad())
+    {
+        buffer.resize(start);
+        return FILE_APPEND_FAILED;
+    }
+    return FILE_APPEND_DONE;
+#endif
+}
+
+std::unique_ptr<InputSource> open_standard_input(InputBackend backend)
+{
+#if defined(GREP_HAS_POSIX_IO)
+    struct stat file_status;
+    if (fstat(STDIN_FILENO, &file_status) != 0 || !S_ISREG(file_status.st_mode) || backend == INPUT_BACKEND_STREAM)
+        return std::make_unique<StreamSource>(STDIN_FILENO, false);
+    off_t current_offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    size_t offset = current_offset > 0 ? static_cast<size_t>(current_offset) : 0;
+    size_t file_size = static_cast<size_t>(file_status.st_size);
+    InputBackend chosen = choose_file_backend(STDIN_FILENO, std::min(offset, file_size), file_size, backend, false);
+    return open_regular_file(STDIN_FILENO, false, nullptr, offset, file_size, chosen);
+#else
+    (void)backend;
+    return std::make_unique<IstreamSource>(std::cin);
+#endif
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// --- Input Sources ---
+// Where the bytes of one input come from. Each backend suits a different
+// kind of input:
+//   mmap        large files already in the page cache: no copy at all
+//   pread       small files: one read into a pooled buffer
+//   read-ahead  large cold files: a background thread reads the next block
+//   io-uring    large cold files: a batch of block reads kept in flight
+//   stream      pipes, terminals and devices: blocks as data arrives
+// INPUT_BACKEND_AUTO picks among them by file type, size and page-cache
+// residency; --io= forces one.
+enum InputBackend
+{
+    INPUT_BACKEND_AUTO = 0,
+    INPUT_BACKEND_MMAP,
+    INPUT_BACKEND_PREAD,
+    INPUT_BACKEND_READ_AHEAD,
+    INPUT_BACKEND_IO_URING,
+    INPUT_BACKEND_STREAM,
+    INPUT_BACKEND_COUNT
+};
+
+// Parses a --io= value. Returns false for an unknown name.
+bool parse_input_backend(std::string_view name, InputBackend &backend);
+const char *input_backend_name(InputBackend backend);
+
+class InputSource
+{
+public:
+    // Regular files below this size are read with pread; larger ones are
+    // mapped or streamed in blocks.
+    static constexpr size_t LARGE_FILE_SIZE = 1 << 20;
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+    static constexpr size_t MAPPED_BLOCK_SIZE = 8 << 20;
+
+    virtual ~InputSource() = default;
+
+    // Returns the next block of input, valid until the following call, or
+    // an empty view at the end of the input or after a read error.
+    virtual std::string_view next_block() = 0;
+
+    InputBackend backend() const { return chosen_backend; }
+
+protected:
+    explicit InputSource(InputBackend backend) : chosen_backend(backend) {}
+
+private:
+    InputBackend chosen_backend;
+};
+
+// Opens path with backend. A backend that cannot serve the input (mmap of a
+// pipe, io_uring where the kernel refuses it) gives way to the automatic
+// choice. Returns null if path cannot be opened.
+std::unique_ptr<InputSource> open_input_source(const std::string &path, InputBackend backend);
+
+// Picks the bytes [first, second) of a file's contents to search.
+using ByteRangeSelector = std::function<std::pair<size_t, size_t>(std::string_view contents)>;
+
+// Opens path like open_input_source, but reads only the range select_range
+// picks from a temporary mapping of the whole file. Inputs that cannot be
+// mapped are read whole, with a note on stderr.
+std::unique_ptr<InputSource> open_input_range(const std::string &path, InputBackend backend, const ByteRangeSelector &select_range);
+
+enum FileAppend
+{
+    FILE_APPEND_DONE = 0,
+    FILE_APPEND_TOO_LARGE,
+    FILE_APPEND_FAILED
+};
+
+// Appends the whole file at path to buffer, for searches that read many
+// small files into one buffer. A file whose size is max_size or more is not
+// read. buffer is left as it was unless the result is FILE_APPEND_DONE.
+FileAppend append_file_contents(const std::string &path, size_t max_size, std::string &buffer);
+
+// Standard input: mapped or pread from its current offset when it is a
+// regular file, otherwise streamed so a slow pipe is searched as it goes.
+std::unique_ptr<InputSource> open_standard_input(InputBackend backend);
@@ -0,0 +1,203 @@
+#include "io_uring.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define GREP_HAS_IO_URING 1
+#endif
+
+#if defined(GREP_HAS_IO_URING)
+
+namespace
+{
+    int io_uring_setup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    // The rings are shared with the kernel: our writes to a tail must be
+    // published after the entry, and the kernel's tail read before its entries.
+    unsigned load_acquire(unsigned *value)
+    {
+        return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+    }
+
+    void store_release(unsigned *value, unsigned new_value)
+    {
+        std::atomic_ref<unsigned>(*value).store(new_value, std::memory_order_release);
+    }
+
+    template <typename T>
+    T *ring_field(void *ring, uint32_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+}
+
+IoUring::IoUring(unsigned entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(entries, &params);
+    if (fd < 0)
+        return;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mapping)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        sq_ring = nullptr;
+        close(fd);
+        return;
+    }
+    cq_ring = single_mapping ? sq_ring : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        munmap(sq_ring, sq_ring_size);
+        sq_ring = cq_ring = sqes = nullptr;
+        close(fd);
+        return;
+    }
+
+    sq_head = ring_field<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = ring_field<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = ring_field<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = ring_field<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = ring_field<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = ring_field<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = ring_field<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = ring_field<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    ring_fd = fd;
+}
+
+IoUring::~IoUring()
+{
+    if (ring_fd < 0)
+        return;
+    munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    close(ring_fd);
+}
+
+bool IoUring::available()
+{
+    // Kernels before 5.6 lack IORING_OP_READ, and containers often block
+    // io_uring_setup outright; either way a small test ring fails to open or
+    // a read of /dev/null fails.
+    static const bool works = []
+    {
+        IoUring ring(1);
+        if (!ring.is_open())
+            return false;
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd < 0)
+            return false;
+        char byte;
+        uint64_t user_data = 0;
+        int result = -1;
+        bool read_ok = ring.submit_read(fd, &byte, 1, 0, 7) && ring.wait_completion(user_data, result) && user_data == 7 && result == 0;
+        close(fd);
+        return read_ok;
+    }();
+    return works;
+}
+
+bool IoUring::submit_read(int fd, char *buffer, size_t length, uint64_t offset, uint64_t user_data)
+{
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe &sqe = static_cast<io_uring_sqe *>(sqes)[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = static_cast<uint32_t>(length);
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    sq_array[index] = index;
+    store_release(sq_tail, tail + 1);
+
+    int submitted;
+    do
+        submitted = io_uring_enter(ring_fd, 1, 0, 0);
+    while (submitted < 0 && (errno == EINTR || errno == EAGAIN));
+    if (submitted == 1)
+        return true;
+
+    // The kernel did not take the entry. Withdraw it, or the next submit
+    // would send this stale read along with its own.
+    if (load_acquire(sq_head) != tail)
+        return true;
+    store_release(sq_tail, tail);
+    return false;
+}
+
+bool IoUring::wait_completion(uint64_t &user_data, int &result)
+{
+    while (true)
+    {
+        unsigned head = *cq_head;
+        if (head != load_acquire(cq_tail))
+        {
+            const io_uring_cqe &cqe = static_cast<io_uring_cqe *>(cqes)[head & *cq_mask];
+            user_data = cqe.user_data;
+            result = cqe.res;
+            store_release(cq_head, head + 1);
+            return true;
+        }
+        if (io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return false;
+    }
+}
+
+#else
+
+IoUring::IoUring(unsigned)
+{
+}
+
+IoUring::~IoUring()
+{
+}
+
+bool IoUring::available()
+{
+    return false;
+}
+
+bool IoUring::submit_read(int, char *, size_t, uint64_t, uint64_t)
+{
+    return false;
+}
+
+bool IoUring::wait_completion(uint64_t &, int &)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// --- io_uring Reads (Linux) ---
+// A minimal io_uring instance set up through the raw system calls, used only
+// to keep several file reads in flight from one thread. Elsewhere, and on
+// kernels or sandboxes without io_uring, is_open() is false.
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries);
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+    ~IoUring();
+
+    // Whether io_uring works here. Probed once per process.
+    static bool available();
+
+    bool is_open() const { return ring_fd >= 0; }
+
+    // Queues and submits a read of length bytes at offset into buffer.
+    bool submit_read(int fd, char *buffer, size_t length, uint64_t offset, uint64_t user_data);
+
+    // Blocks until a read completes. result is the byte count or -errno.
+    bool wait_completion(uint64_t &user_data, int &result);
+
+private:
+    int ring_fd = -1;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    void *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    void *cqes = nullptr;
+};
@@ -0,0 +1,190 @@
+#include "line_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "grep_engine.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_MMAP 1
+#endif
+
+namespace
+{
+    // File layout (native byte order):
+    //   header | line_starts[entry_count]
+    struct LineIndexHeader
+    {
+        char magic[8];
+        uint64_t byte_order_mark;
+        uint64_t lines_per_entry;
+        uint64_t file_size;
+        int64_t file_modified;
+        uint64_t entry_count;
+    };
+
+    constexpr char SIDECAR_MAGIC[8] = {'G', 'R', 'E', 'P', 'L', 'I', 'X', '1'};
+    constexpr uint64_t BYTE_ORDER_MARK = 0x0102030405060708ull;
+
+    // Counting runs a chunk at a time until the chunk holding the wanted
+    // newline, which is then found byte by byte.
+    constexpr size_t COUNT_CHUNK = 4096;
+
+    // The position just past the count-th newline in [begin, end), or null if
+    // there are fewer; count is reduced by the newlines passed.
+    const char *skip_newlines(const char *begin, const char *end, uint64_t &count)
+    {
+        while (static_cast<size_t>(end - begin) >= COUNT_CHUNK)
+        {
+            size_t chunk_newlines = count_newlines(begin, begin + COUNT_CHUNK);
+            if (chunk_newlines >= count)
+                break;
+            count -= chunk_newlines;
+            begin += COUNT_CHUNK;
+        }
+        while (const void *newline = std::memchr(begin, '\n', static_cast<size_t>(end - begin)))
+        {
+            begin = static_cast<const char *>(newline) + 1;
+            if (--count == 0)
+                return begin;
+        }
+        return nullptr;
+    }
+}
+
+bool file_identity(const std::string &path, FileIdentity &identity)
+{
+    std::error_code error;
+    identity.size = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    identity.modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+LineIndex::~LineIndex()
+{
+#if defined(GREP_HAS_MMAP)
+    if (is_mapped)
+        munmap(const_cast<unsigned char *>(file_data), file_size);
+#endif
+}
+
+std::unique_ptr<LineIndex> LineIndex::open(const std::string &path, const FileIdentity &identity)
+{
+    std::string sidecar = path + SIDECAR_SUFFIX;
+    std::unique_ptr<LineIndex> index(new LineIndex());
+#if defined(GREP_HAS_MMAP)
+    int fd = ::open(sidecar.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0 || file_status.st_size < static_cast<off_t>(sizeof(LineIndexHeader)))
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *mapping = mmap(nullptr, static_cast<size_t>(file_status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+    index->file_data = static_cast<const unsigned char *>(mapping);
+    index->file_size = static_cast<size_t>(file_status.st_size);
+    index->is_mapped = true;
+#else
+    std::ifstream in(sidecar, std::ios::binary);
+    if (!in.is_open())
+        return nullptr;
+    index->file_copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    index->file_data = index->file_copy.data();
+    index->file_size = index->file_copy.size();
+#endif
+
+    LineIndexHeader header;
+    if (index->file_size < sizeof(header))
+        return nullptr;
+    std::memcpy(&header, index->file_data, sizeof(header));
+    if (std::memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 || header.byte_order_mark != BYTE_ORDER_MARK ||
+        header.lines_per_entry != LINES_PER_ENTRY || header.file_size != identity.size || header.file_modified != identity.modified ||
+        header.entry_count == 0 || index->file_size != sizeof(header) + header.entry_count * sizeof(uint64_t))
+        return nullptr;
+
+    index->line_starts = reinterpret_cast<const uint64_t *>(index->file_data + sizeof(header));
+    index->entry_count = header.entry_count;
+    return index;
+}
+
+size_t LineIndex::line_number_at(uint64_t offset, std::string_view text, uint64_t text_offset, size_t line_at_text) const
+{
+    // The last entry at or before offset, if text reaches back to it.
+    const uint64_t *entry = std::upper_bound(line_starts, line_starts + entry_count, offset) - 1;
+    size_t line_number = line_at_text;
+    uint64_t counted_from = text_offset;
+    if (*entry >= text_offset)
+    {
+        line_number = static_cast<size_t>((entry - line_starts) * LINES_PER_ENTRY + 1);
+        counted_from = *entry;
+    }
+    const char *begin = text.data() + (counted_from - text_offset);
+    return line_number + count_newlines(begin, text.data() + (offset - text_offset));
+}
+
+void LineIndexBuilder::add_block(std::string_view block)
+{
+    const char *cursor = block.data();
+    const char *end = block.data() + block.size();
+    while (const char *line_start = skip_newlines(cursor, end, newlines_to_next_entry))
+    {
+        line_starts.push_back(scanned_bytes + static_cast<uint64_t>(line_start - block.data()));
+        newlines_to_next_entry = LineIndex::LINES_PER_ENTRY;
+        cursor = line_start;
+    }
+    scanned_bytes += block.size();
+}
+
+bool LineIndexBuilder::write(const std::string &path, const FileIdentity &identity) const
+{
+    FileIdentity current;
+    if (!file_identity(path, current) || current.size != identity.size || current.modified != identity.modified ||
+        scanned_bytes != identity.size)
+        return false;
+
+    LineIndexHeader header;
+    std::memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.byte_order_mark = BYTE_ORDER_MARK;
+    header.lines_per_entry = LineIndex::LINES_PER_ENTRY;
+    header.file_size = identity.size;
+    header.file_modified = identity.modified;
+    header.entry_count = line_starts.size();
+
+    // Written under a temporary name and renamed, so a concurrent search
+    // never maps half a sidecar.
+    std::string sidecar = path + LineIndex::SIDECAR_SUFFIX;
+    std::string temporary = sidecar + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return false;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(line_starts.data()), line_starts.size() * sizeof(uint64_t));
+        if (!out.good())
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), sidecar.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
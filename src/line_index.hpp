@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Line Index Sidecars (--line-index) ---
+// Line numbers in a large file otherwise cost counting every newline from
+// its start. A sidecar next to the file, path + SIDECAR_SUFFIX, records
+// where every LINES_PER_ENTRY-th line starts. It is written at the end of a
+// full scan and used by later searches while the file keeps the size and
+// modification time it was built for, so a line number only needs the
+// newlines after the nearest entry before it.
+struct FileIdentity
+{
+    uint64_t size = 0;
+    int64_t modified = 0; // Modification time in the file clock's ticks
+};
+
+// False if path cannot be examined.
+bool file_identity(const std::string &path, FileIdentity &identity);
+
+class LineIndex
+{
+public:
+    static constexpr uint64_t LINES_PER_ENTRY = 1024;
+    static constexpr uint64_t MIN_FILE_SIZE = 1 << 20; // Smaller files are quick to count
+    static constexpr const char *SIDECAR_SUFFIX = ".lidx";
+
+    LineIndex(const LineIndex &) = delete;
+    LineIndex &operator=(const LineIndex &) = delete;
+    ~LineIndex();
+
+    // Maps the sidecar of path if it exists and was built for identity.
+    static std::unique_ptr<LineIndex> open(const std::string &path, const FileIdentity &identity);
+
+    // The number of the line holding offset. text holds the file's bytes from
+    // text_offset on, and line_at_text is the number of the line text starts
+    // in; text must reach offset.
+    size_t line_number_at(uint64_t offset, std::string_view text, uint64_t text_offset, size_t line_at_text) const;
+
+private:
+    LineIndex() = default;
+
+    const unsigned char *file_data = nullptr;
+    size_t file_size = 0;
+    bool is_mapped = false;
+    std::vector<unsigned char> file_copy; // Used where mmap is unavailable
+    const uint64_t *line_starts = nullptr; // Entry i: offset of line i * LINES_PER_ENTRY + 1
+    uint64_t entry_count = 0;
+};
+
+// Collects the entries while a file is scanned from its start. Every block
+// must be passed, in order.
+class LineIndexBuilder
+{
+public:
+    void add_block(std::string_view block);
+
+    // Writes the sidecar of path if the file still matches identity. Returns
+    // false if it changed or the sidecar cannot be written.
+    bool write(const std::string &path, const FileIdentity &identity) const;
+
+private:
+    std::vector<uint64_t> line_starts{0};
+    uint64_t scanned_bytes = 0;
+    uint64_t newlines_to_next_entry = LineIndex::LINES_PER_ENTRY;
+};
@@ -0,0 +1,435 @@
+#include "literal_matcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GREP_X86_SIMD 1
+#endif
+
+namespace
+{
+    // --- Build-time Trie ---
+    // Left-child/right-sibling trie built from sorted literals, so the child a
+    // literal continues through is always the most recently added one.
+    struct TrieNode
+    {
+        int32_t first_child = -1;
+        int32_t last_child = -1;
+        int32_t next_sibling = -1;
+        uint16_t code = 0;
+        uint32_t depth = 0;
+        bool is_terminal = false;
+    };
+
+    // --- Double-array Placement ---
+    // Free slots of the double array, linked in slot order so the search for
+    // a base jumps from one free slot to the next. A slot that has failed
+    // MAX_SLOT_ATTEMPTS times as the first child's slot leaves the list. It
+    // stays free for bases found through other slots, but the search no
+    // longer starts from nearly full regions, so placement stays linear in
+    // the trie size.
+    class FreeSlotList
+    {
+    public:
+        static constexpr int32_t NONE = -1;
+        static constexpr uint8_t MAX_SLOT_ATTEMPTS = 16;
+
+        int32_t first() const { return head; }
+        int32_t next(int32_t slot) const { return next_free[slot]; }
+
+        // Links the new slots up to size in at the end.
+        void grow(size_t size)
+        {
+            size_t old_size = next_free.size();
+            if (size <= old_size)
+                return;
+            next_free.resize(size, NONE);
+            previous_free.resize(size, NONE);
+            attempts.resize(size, 0);
+            linked.resize(size, true);
+            for (size_t slot = old_size; slot < size; ++slot)
+            {
+                int32_t new_slot = static_cast<int32_t>(slot);
+                previous_free[slot] = tail;
+                if (tail == NONE)
+                    head = new_slot;
+                else
+                    next_free[tail] = new_slot;
+                tail = new_slot;
+            }
+        }
+
+        void remove(int32_t slot)
+        {
+            if (!linked[slot])
+                return;
+            linked[slot] = false;
+            int32_t before = previous_free[slot];
+            int32_t after = next_free[slot];
+            if (before == NONE)
+                head = after;
+            else
+                next_free[before] = after;
+            if (after == NONE)
+                tail = before;
+            else
+                previous_free[after] = before;
+        }
+
+        void record_failure(int32_t slot)
+        {
+            if (++attempts[slot] >= MAX_SLOT_ATTEMPTS)
+                remove(slot);
+        }
+
+    private:
+        std::vector<int32_t> next_free;
+        std::vector<int32_t> previous_free;
+        std::vector<uint8_t> attempts;
+        std::vector<bool> linked;
+        int32_t head = NONE;
+        int32_t tail = NONE;
+    };
+
+    // Rough frequency rank of a byte in text and log data; lower is rarer.
+    int byte_commonness(unsigned char byte)
+    {
+        if (byte == ' ')
+            return 255;
+        if (std::strchr("etaoinsrhl", byte) && byte != '\0')
+            return 220;
+        if (byte >= 'a' && byte <= 'z')
+            return 180;
+        if (byte >= '0' && byte <= '9')
+            return 170;
+        if (std::strchr(".,:/-_=\"'\t", byte) && byte != '\0')
+            return 150;
+        if (byte >= 'A' && byte <= 'Z')
+            return 120;
+        if (byte >= 0x21 && byte < 0x7f)
+            return 80;
+        if (byte >= 0x80)
+            return 40;
+        return 10;
+    }
+
+    void choose_rare_bytes(LiteralAutomaton &automaton, const std::vector<std::string> &literals)
+    {
+        std::vector<unsigned char> rare_bytes;
+        size_t max_rare_offset = 0;
+        for (const std::string &literal : literals)
+        {
+            size_t rarest_offset = 0;
+            for (size_t offset = 1; offset < literal.size(); ++offset)
+            {
+                if (byte_commonness(literal[offset]) < byte_commonness(literal[rarest_offset]))
+                    rarest_offset = offset;
+            }
+
+            unsigned char rare_byte = static_cast<unsigned char>(literal[rarest_offset]);
+            if (std::find(rare_bytes.begin(), rare_bytes.end(), rare_byte) == rare_bytes.end())
+            {
+                rare_bytes.push_back(rare_byte);
+                if (rare_bytes.size() > LiteralAutomaton::MAX_PREFILTER_BYTES)
+                    return; // Too many distinct bytes for the prefilter to pay off
+            }
+            max_rare_offset = std::max(max_rare_offset, rarest_offset);
+        }
+
+        automaton.rare_bytes = rare_bytes;
+        automaton.max_rare_offset = max_rare_offset;
+    }
+
+    // Finds the first byte at or after cursor that is one of the (at most
+    // three) prefilter bytes.
+    const unsigned char *find_rare_byte(const LiteralAutomaton &automaton, const unsigned char *cursor, const unsigned char *text_end)
+    {
+        const std::vector<unsigned char> &rare_bytes = automaton.rare_bytes;
+        if (rare_bytes.size() == 1)
+        {
+            const void *found = std::memchr(cursor, rare_bytes[0], text_end - cursor);
+            return found ? static_cast<const unsigned char *>(found) : text_end;
+        }
+
+#if defined(GREP_X86_SIMD)
+        const __m128i first = _mm_set1_epi8(static_cast<char>(rare_bytes[0]));
+        const __m128i second = _mm_set1_epi8(static_cast<char>(rare_bytes[1]));
+        const __m128i third = _mm_set1_epi8(static_cast<char>(rare_bytes.back()));
+        while (text_end - cursor >= 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cursor));
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second)),
+                                        _mm_cmpeq_epi8(block, third));
+            int hit_mask = _mm_movemask_epi8(hits);
+            if (hit_mask != 0)
+                return cursor + __builtin_ctz(static_cast<unsigned>(hit_mask));
+            cursor += 16;
+        }
+#endif
+        while (cursor < text_end && std::find(rare_bytes.begin(), rare_bytes.end(), *cursor) == rare_bytes.end())
+            ++cursor;
+        return cursor;
+    }
+
+    int32_t double_array_child(const LiteralAutomaton &automaton, int32_t state, uint32_t code)
+    {
+        size_t slot = static_cast<size_t>(automaton.base[state]) + code;
+        if (slot < automaton.check.size() && automaton.check[slot] == state)
+            return static_cast<int32_t>(slot);
+        return LiteralAutomaton::FREE_SLOT;
+    }
+
+    // One Aho-Corasick step through the double array and failure links.
+    int32_t follow_failure_links(const LiteralAutomaton &automaton, int32_t state, uint32_t code)
+    {
+        if (code == 0)
+            return LiteralAutomaton::ROOT_STATE;
+        while (true)
+        {
+            int32_t child = double_array_child(automaton, state, code);
+            if (child != LiteralAutomaton::FREE_SLOT)
+                return child;
+            if (state == LiteralAutomaton::ROOT_STATE)
+                return LiteralAutomaton::ROOT_STATE;
+            state = automaton.failure[state];
+        }
+    }
+}
+
+size_t LiteralAutomaton::memory_bytes() const
+{
+    return (base.size() + check.size() + failure.size()) * sizeof(int32_t) +
+           (longest_match.size() + resolved_transitions.size()) * sizeof(uint32_t);
+}
+
+LiteralAutomaton build_literal_automaton(std::vector<std::string> literals)
+{
+    LiteralAutomaton automaton;
+    std::sort(literals.begin(), literals.end());
+    literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+    if (!literals.empty() && literals.front().empty())
+    {
+        automaton.matches_empty = true;
+        literals.erase(literals.begin());
+    }
+    automaton.literal_count = literals.size() + (automaton.matches_empty ? 1 : 0);
+
+    // Only bytes that occur in some literal get their own code.
+    std::array<bool, 256> byte_used{};
+    for (const std::string &literal : literals)
+    {
+        for (char literal_char : literal)
+            byte_used[static_cast<unsigned char>(literal_char)] = true;
+        automaton.max_literal_length = std::max(automaton.max_literal_length, literal.size());
+    }
+    for (int byte = 0; byte < 256; ++byte)
+    {
+        if (byte_used[byte])
+            automaton.byte_code[byte] = static_cast<uint16_t>(automaton.code_count++);
+    }
+
+    std::vector<TrieNode> trie(1);
+    for (const std::string &literal : literals)
+    {
+        int32_t node = 0;
+        for (char literal_char : literal)
+        {
+            uint16_t code = automaton.byte_code[static_cast<unsigned char>(literal_char)];
+            int32_t child = trie[node].last_child;
+            if (child < 0 || trie[child].code != code)
+            {
+                TrieNode new_node;
+                new_node.code = code;
+                new_node.depth = trie[node].depth + 1;
+                child = static_cast<int32_t>(trie.size());
+                trie.push_back(new_node);
+                if (trie[node].last_child < 0)
+                    trie[node].first_child = child;
+                else
+                    trie[trie[node].last_child].next_sibling = child;
+                trie[node].last_child = child;
+            }
+            node = child;
+        }
+        trie[node].is_terminal = true;
+    }
+    automaton.state_count = trie.size();
+
+    // Place nodes into the double array in breadth-first order, giving each
+    // node the first base, found through the free-slot list, at which all of
+    // its children's slots are free, or a base past the end of the array.
+    std::vector<int32_t> slot_of_node(trie.size(), LiteralAutomaton::FREE_SLOT);
+    std::vector<int32_t> bfs_slots;
+    bfs_slots.reserve(trie.size());
+    automaton.check.assign(1, LiteralAutomaton::FREE_SLOT);
+    automaton.base.assign(1, 0);
+    slot_of_node[0] = LiteralAutomaton::ROOT_STATE;
+
+    FreeSlotList free_slots;
+    free_slots.grow(1);
+    free_slots.remove(LiteralAutomaton::ROOT_STATE);
+    std::deque<int32_t> pending_nodes = {0};
+    std::vector<uint16_t> child_codes;
+    while (!pending_nodes.empty())
+    {
+        int32_t node = pending_nodes.front();
+        pending_nodes.pop_front();
+        int32_t slot = slot_of_node[node];
+        bfs_slots.push_back(slot);
+
+        child_codes.clear();
+        for (int32_t child = trie[node].first_child; child >= 0; child = trie[child].next_sibling)
+            child_codes.push_back(trie[child].code);
+        if (child_codes.empty())
+            continue;
+
+        size_t base_value = automaton.check.size() >= child_codes[0] ? automaton.check.size() - child_codes[0] : 0;
+        for (int32_t candidate_slot = free_slots.first(); candidate_slot != FreeSlotList::NONE;)
+        {
+            size_t candidate_base = static_cast<size_t>(candidate_slot) >= child_codes[0] ? candidate_slot - child_codes[0] : 0;
+            bool fits = std::all_of(child_codes.begin(), child_codes.end(), [&](uint16_t code)
+                                    { return candidate_base + code >= automaton.check.size() ||
+                                             automaton.check[candidate_base + code] == LiteralAutomaton::FREE_SLOT; });
+            if (fits)
+            {
+                base_value = candidate_base;
+                break;
+            }
+            int32_t next_slot = free_slots.next(candidate_slot);
+            free_slots.record_failure(candidate_slot);
+            candidate_slot = next_slot;
+        }
+
+        size_t needed_size = base_value + child_codes.back() + 1;
+        if (needed_size > automaton.check.size())
+        {
+            automaton.check.resize(needed_size, LiteralAutomaton::FREE_SLOT);
+            automaton.base.resize(needed_size, 0);
+            free_slots.grow(needed_size);
+        }
+        automaton.base[slot] = static_cast<int32_t>(base_value);
+        for (int32_t child = trie[node].first_child; child >= 0; child = trie[child].next_sibling)
+        {
+            size_t child_slot = base_value + trie[child].code;
+            automaton.check[child_slot] = slot;
+            free_slots.remove(static_cast<int32_t>(child_slot));
+            slot_of_node[child] = static_cast<int32_t>(child_slot);
+            pending_nodes.push_back(child);
+        }
+    }
+
+    // Failure links and outputs, again breadth-first so every link points at
+    // a shallower, already finished state.
+    size_t slot_count = automaton.check.size();
+    automaton.failure.assign(slot_count, LiteralAutomaton::ROOT_STATE);
+    automaton.longest_match.assign(slot_count, 0);
+    std::vector<int32_t> node_of_slot(slot_count, LiteralAutomaton::FREE_SLOT);
+    for (size_t node = 0; node < trie.size(); ++node)
+        node_of_slot[slot_of_node[node]] = static_cast<int32_t>(node);
+
+    for (int32_t slot : bfs_slots)
+    {
+        const TrieNode &node = trie[node_of_slot[slot]];
+        if (slot != LiteralAutomaton::ROOT_STATE)
+        {
+            int32_t parent = automaton.check[slot];
+            automaton.failure[slot] = parent == LiteralAutomaton::ROOT_STATE
+                                          ? LiteralAutomaton::ROOT_STATE
+                                          : follow_failure_links(automaton, automaton.failure[parent], node.code);
+            automaton.longest_match[slot] = node.is_terminal ? node.depth : automaton.longest_match[automaton.failure[slot]];
+        }
+    }
+
+    if (slot_count * automaton.code_count <= LiteralAutomaton::MAX_RESOLVED_TABLE_ENTRIES)
+    {
+        automaton.resolved_transitions.assign(slot_count * automaton.code_count, LiteralAutomaton::ROOT_STATE);
+        for (int32_t slot : bfs_slots)
+        {
+            uint32_t *row = &automaton.resolved_transitions[static_cast<size_t>(slot) * automaton.code_count];
+            const uint32_t *failure_row = &automaton.resolved_transitions[static_cast<size_t>(automaton.failure[slot]) * automaton.code_count];
+            for (uint32_t code = 1; code < automaton.code_count; ++code)
+            {
+                int32_t child = double_array_child(automaton, slot, code);
+                if (child == LiteralAutomaton::FREE_SLOT)
+                    row[code] = slot == LiteralAutomaton::ROOT_STATE ? LiteralAutomaton::ROOT_STATE : failure_row[code];
+                else
+                    row[code] = static_cast<uint32_t>(child) | (automaton.longest_match[child] ? LiteralAutomaton::MATCH_FLAG : 0);
+            }
+        }
+    }
+
+    if (!literals.empty())
+        choose_rare_bytes(automaton, literals);
+    return automaton;
+}
+
+size_t find_leftmost_literal(const LiteralAutomaton &automaton, std::string_view text, size_t from, size_t &match_end,
+                             size_t &skipped_bytes)
+{
+    if (automaton.matches_empty)
+    {
+        match_end = from;
+        return from;
+    }
+    if (automaton.state_count <= 1 || from >= text.size())
+        return std::string_view::npos;
+
+    const unsigned char *text_begin = reinterpret_cast<const unsigned char *>(text.data());
+    const unsigned char *text_end = text_begin + text.size();
+    const unsigned char *cursor = text_begin + from;
+    const uint16_t *byte_code = automaton.byte_code.data();
+    const uint32_t *resolved = automaton.resolved_transitions.data();
+    const uint32_t code_count = automaton.code_count;
+    bool use_prefilter = !automaton.rare_bytes.empty();
+
+    // Each state knows the longest literal ending at it, i.e. the leftmost
+    // start among matches ending here. The leftmost match overall is settled
+    // once the scan is max_literal_length bytes past the best start so far;
+    // the first end seen for that start is its shortest literal.
+    size_t best_start = std::string_view::npos;
+    uint32_t state = LiteralAutomaton::ROOT_STATE;
+    while (cursor < text_end)
+    {
+        if (state == LiteralAutomaton::ROOT_STATE && use_prefilter && best_start == std::string_view::npos)
+        {
+            const unsigned char *rare = find_rare_byte(automaton, cursor, text_end);
+            if (rare == text_end)
+            {
+                skipped_bytes += static_cast<size_t>(text_end - cursor);
+                break;
+            }
+            size_t rare_pos = static_cast<size_t>(rare - text_begin);
+            const unsigned char *resume = text_begin + std::max(static_cast<size_t>(cursor - text_begin),
+                                                                rare_pos >= automaton.max_rare_offset ? rare_pos - automaton.max_rare_offset : 0);
+            skipped_bytes += static_cast<size_t>(resume - cursor);
+            cursor = resume;
+        }
+
+        uint32_t longest;
+        if (resolved)
+        {
+            uint32_t next = resolved[static_cast<size_t>(state) * code_count + byte_code[*cursor]];
+            state = next & ~LiteralAutomaton::MATCH_FLAG;
+            longest = (next & LiteralAutomaton::MATCH_FLAG) ? automaton.longest_match[state] : 0;
+        }
+        else
+        {
+            state = static_cast<uint32_t>(follow_failure_links(automaton, static_cast<int32_t>(state), byte_code[*cursor]));
+            longest = automaton.longest_match[state];
+        }
+        ++cursor;
+
+        size_t position = static_cast<size_t>(cursor - text_begin);
+        if (longest && position - longest < best_start)
+        {
+            best_start = position - longest;
+            match_end = position;
+        }
+        if (best_start != std::string_view::npos && position - best_start >= automaton.max_literal_length)
+            break;
+    }
+    return best_start;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Fixed-String Set Matching (-F) ---
+// Aho-Corasick automaton over a set of literals. The trie is packed into a
+// double array (the child of state s on code c is slot base[s] + c, valid when
+// check[base[s] + c] == s) over compressed byte codes, so memory grows with
+// the total literal length rather than with the alphabet. When the resolved
+// DFA (failure links folded into a full transition table) fits a fixed budget
+// it is used instead; larger sets follow failure links at scan time.
+struct LiteralAutomaton
+{
+    static constexpr int32_t ROOT_STATE = 0;
+    static constexpr int32_t FREE_SLOT = -1;
+    static constexpr uint32_t MATCH_FLAG = 1u << 31; // Set on resolved entries whose target ends a literal
+    static constexpr size_t MAX_RESOLVED_TABLE_ENTRIES = 1 << 20;
+    static constexpr size_t MAX_PREFILTER_BYTES = 3;
+
+    std::array<uint16_t, 256> byte_code{}; // 0 for bytes that occur in no literal
+    uint32_t code_count = 1;
+
+    std::vector<int32_t> base;
+    std::vector<int32_t> check;
+    std::vector<int32_t> failure;
+    std::vector<uint32_t> longest_match; // Longest literal ending at this state, 0 if none
+    std::vector<uint32_t> resolved_transitions; // slot * code_count + code, MATCH_FLAG-tagged
+
+    size_t literal_count = 0;
+    size_t state_count = 0;
+    size_t max_literal_length = 0;
+    bool matches_empty = false; // The set contains "", which matches at every position
+
+    // Rare-byte prefilter: every literal contains one of these bytes at most
+    // max_rare_offset bytes after its start.
+    std::vector<unsigned char> rare_bytes;
+    size_t max_rare_offset = 0;
+
+    bool uses_resolved_transitions() const { return !resolved_transitions.empty(); }
+    size_t memory_bytes() const;
+};
+
+LiteralAutomaton build_literal_automaton(std::vector<std::string> literals);
+
+// Returns the start of the leftmost literal occurrence at or after from and
+// sets match_end to the end of the shortest literal starting there, or
+// returns npos if there is none. Bytes the rare-byte prefilter passed over
+// without stepping the automaton are added to skipped_bytes.
+size_t find_leftmost_literal(const LiteralAutomaton &automaton, std::string_view text, size_t from, size_t &match_end,
+                             size_t &skipped_bytes);
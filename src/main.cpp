@@ -0,0 +1,1154 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <string_view>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include "grep_engine.hpp"
+#include "backtracking_matcher.hpp"
+#include "deadline.hpp"
+#include "follow.hpp"
+#include "generator.hpp"
+#include "input_source.hpp"
+#include "line_index.hpp"
+#include "literal_matcher.hpp"
+#include "match_index.hpp"
+#include "page_cache.hpp"
+#include "pattern_analyzer.hpp"
+#include "scan_stats.hpp"
+#include "thread_pool.hpp"
+#include "time_range.hpp"
+#include "token_filter.hpp"
+namespace fs = std::filesystem;
+
+// --- Ordered Parallel Output ---
+// A search target: a file, whose printed lines are buffered in output, or a
+// directory, whose entries are listed in sorted order once it is traversed.
+struct SearchResult
+{
+    std::string path;
+    bool is_directory = false;
+    bool found = false;
+    size_t prefetched_bytes = 0; // Prefetch budget held until the file is searched
+    std::string incomplete_reason; // Why a time budget cut this target short, empty if it did not
+    std::string output;
+    std::string index_records; // MATCH records for --emit-index
+    std::vector<std::unique_ptr<SearchResult>> entries;
+    std::atomic<bool> ready{false};
+};
+
+// Writes results in traversal order however the pool completes them. A
+// depth-first cursor advances over ready results and stops at the first one
+// still pending; whichever task completes that one flushes the next run.
+struct OrderedOutput
+{
+    std::mutex write_mutex;
+    std::vector<std::pair<SearchResult *, size_t>> cursor; // Directory and its next entry
+    bool found_any = false;
+    bool incomplete_any = false;
+    MatchIndexWriter *index_writer = nullptr; // Set under --emit-index
+
+    explicit OrderedOutput(SearchResult *root) : cursor{{root, 0}} {}
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        while (!cursor.empty())
+        {
+            auto &[directory, next_entry] = cursor.back();
+            if (next_entry == directory->entries.size())
+            {
+                cursor.pop_back();
+                continue;
+            }
+            SearchResult *entry = directory->entries[next_entry].get();
+            if (!entry->ready.load(std::memory_order_acquire))
+                return;
+            next_entry++;
+            write_result(entry);
+            if (entry->is_directory)
+                cursor.push_back({entry, 0});
+        }
+    }
+
+    // Writes a finished result at once, out of order, for --cache-first; the
+    // later ordered pass finds it empty.
+    void write_now(SearchResult *result)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        write_result(result);
+    }
+
+private:
+    // Writes the printed lines and index records, and reports a time budget
+    // cutting the target short on stderr. Called with write_mutex held.
+    void write_result(SearchResult *result)
+    {
+        std::cout << result->output;
+        std::string().swap(result->output);
+        if (index_writer && !result->index_records.empty())
+        {
+            index_writer->add_file(result->path, result->index_records);
+            std::string().swap(result->index_records);
+        }
+        found_any = found_any || result->found;
+        if (!result->incomplete_reason.empty())
+        {
+            std::cerr << "Warning: " << result->path << ": " << result->incomplete_reason << '\n';
+            result->incomplete_reason.clear();
+            incomplete_any = true;
+        }
+    }
+};
+
+// --- Search Pipeline ---
+// Every input is searched by a chain of coroutine stages: the reader yields
+// blocks of whole lines, the matcher yields each block with its matches and
+// the formatter yields the printed output. Blocks are pulled one at a time,
+// so outside multiline mode memory stays bounded by the block size. Bytes
+// come from an InputSource, whose backend suits the input's type and size.
+// Under --stats the stages also add to a ScanStats.
+using BlockMatcher = std::function<MatchInfo(std::string_view, const Deadline &)>;
+
+struct MatchedBlock
+{
+    std::string_view text;
+    MatchInfo match_info;
+};
+
+Generator<std::string_view> read_source_chunks(InputSource &source, ScanStats *stats)
+{
+    for (std::string_view block = source.next_block(); !block.empty(); block = source.next_block())
+    {
+        if (stats)
+            ScanStats::add(stats->bytes_by_backend[source.backend()], block.size());
+        co_yield block;
+    }
+}
+
+// Regroups chunks into blocks that end on a line boundary, except the last.
+// Complete lines are passed on straight from the chunk; only a line split
+// across two chunks is copied. With whole_input the entire input is one
+// block.
+Generator<std::string_view> split_line_blocks(Generator<std::string_view> chunks, bool whole_input)
+{
+    std::string pending; // Unfinished last line, or everything so far with whole_input
+    for (std::string_view chunk : chunks)
+    {
+        if (whole_input)
+        {
+            pending.append(chunk);
+            continue;
+        }
+        if (!pending.empty())
+        {
+            size_t line_end = chunk.find('\n');
+            if (line_end == std::string_view::npos)
+            {
+                pending.append(chunk);
+                continue;
+            }
+            pending.append(chunk.substr(0, line_end + 1));
+            co_yield std::string_view(pending);
+            pending.clear();
+            chunk.remove_prefix(line_end + 1);
+        }
+        size_t last_newline = chunk.rfind('\n');
+        if (last_newline != std::string_view::npos)
+        {
+            co_yield chunk.substr(0, last_newline + 1);
+            chunk.remove_prefix(last_newline + 1);
+        }
+        pending.append(chunk);
+    }
+    if (!pending.empty())
+        co_yield std::string_view(pending);
+}
+
+// Outside multiline mode no state can consume '\n', so matches stay within
+// lines exactly as if each line had been searched on its own.
+MatchedBlock match_line_block(std::string_view block, const BlockMatcher &match_block, const Deadline &deadline)
+{
+    MatchedBlock matched_block{block, match_block(block, deadline)};
+    auto &matches = matched_block.match_info.matches;
+    // A trailing '\n' ends the last line rather than starting an empty one.
+    if (!block.empty() && block.back() == '\n' && !matches.empty() && matches.back().first == block.size())
+        matches.pop_back();
+    matched_block.match_info.found = !matches.empty();
+    return matched_block;
+}
+
+// Once deadline expires, between blocks or inside one, the stage stops after
+// yielding what was matched and sets interrupted, which must outlive the
+// generator.
+Generator<MatchedBlock> match_blocks(Generator<std::string_view> blocks, BlockMatcher match_block, Deadline deadline,
+                                     bool &interrupted)
+{
+    for (std::string_view block : blocks)
+    {
+        if (deadline.expired())
+        {
+            interrupted = true;
+            co_return;
+        }
+        MatchedBlock matched_block = match_line_block(block, match_block, deadline);
+        bool block_interrupted = matched_block.match_info.interrupted;
+        co_yield std::move(matched_block);
+        if (block_interrupted)
+        {
+            interrupted = true;
+            co_return;
+        }
+    }
+}
+
+// Where the next block starts in its file. Under --line-index a sidecar
+// lets the line number after a block be counted from its last entry rather
+// than from the block start, and a full scan without one collects it.
+struct FilePosition
+{
+    size_t line_number = 1;
+    uint64_t offset = 0;
+    const LineIndex *line_index = nullptr;
+    LineIndexBuilder *line_index_builder = nullptr;
+};
+
+// The printed lines of one block, empty for a block without matches.
+// position is that of the block and is advanced past it.
+std::string format_matched_block(const MatchedBlock &block, bool use_color, bool show_line_numbers, const std::string &file_prefix,
+                                 FilePosition &position)
+{
+    LineCounter line_counter{0, position.line_number};
+    std::string output;
+    if (block.match_info.found)
+    {
+        std::ostringstream out;
+        print_matching_lines(block.text, block.match_info, use_color, show_line_numbers ? &line_counter : nullptr, file_prefix, out);
+        output = std::move(out).str();
+    }
+    uint64_t block_end = position.offset + block.text.size();
+    if (show_line_numbers)
+        position.line_number = position.line_index ? position.line_index->line_number_at(block_end, block.text, position.offset, position.line_number)
+                                                   : line_counter.line_number_at(block.text, block.text.size());
+    if (position.line_index_builder)
+        position.line_index_builder->add_block(block.text);
+    position.offset = block_end;
+    return output;
+}
+
+// Yields the printed lines of each block, starting at position. Line
+// numbers carry over from one block to the next. Under --emit-index every
+// block also goes to index.
+Generator<std::string> format_matches(Generator<MatchedBlock> matched_blocks, bool use_color, bool show_line_numbers,
+                                      std::string file_prefix, MatchIndexEncoder *index, FilePosition position = {})
+{
+    for (MatchedBlock &block : matched_blocks)
+    {
+        if (index)
+            index->add_block(block.text, block.match_info);
+        std::string output = format_matched_block(block, use_color, show_line_numbers, file_prefix, position);
+        co_yield std::move(output);
+    }
+}
+
+// What every file search on the pool shares. finish runs once a result is
+// complete.
+struct FileSearchSettings
+{
+    BlockMatcher match_block;
+    bool use_color = true;
+    bool show_line_numbers = false;
+    bool prefix_paths = false;
+    Deadline global_deadline;
+    double file_timeout_seconds = 0;
+    std::function<void(SearchResult *)> finish;
+    InputBackend input_backend = INPUT_BACKEND_AUTO;
+    ScanStats *stats = nullptr; // Set under --stats
+    const PatternIdLookup *pattern_id_of = nullptr; // Set under --emit-index
+    const TimeRange *time_range = nullptr;          // Set under --since/--until
+    bool use_line_index = false;
+};
+
+// Searches one file on the pool at priority. The coroutine goes back to the
+// pool after every block, so traversal and other files are not held up
+// behind a large file, and a worker blocked on a read leaves the others
+// matching.
+DetachedTask search_file_on_pool(ThreadPool &pool, TaskPriority priority, SearchResult *result, const FileSearchSettings &settings)
+{
+    co_await pool.schedule(priority);
+    if (settings.global_deadline.expired())
+    {
+        result->incomplete_reason = "skipped, --timeout expired";
+        if (settings.stats)
+        {
+            ScanStats::add(settings.stats->files_skipped, 1);
+            ScanStats::add(settings.stats->files_done, 1);
+        }
+        settings.finish(result);
+        co_return;
+    }
+
+    Deadline file_deadline = Deadline::after_seconds(settings.file_timeout_seconds, "--file-timeout");
+    const Deadline &deadline = Deadline::earliest(settings.global_deadline, file_deadline);
+    bool interrupted = false;
+    // A large file's line index sidecar is used if it is current, and built
+    // by a full scan if not.
+    FilePosition position;
+    FileIdentity identity;
+    std::unique_ptr<LineIndex> line_index;
+    std::optional<LineIndexBuilder> line_index_builder;
+    if (settings.use_line_index && file_identity(result->path, identity) && identity.size >= LineIndex::MIN_FILE_SIZE)
+    {
+        line_index = LineIndex::open(result->path, identity);
+        if (!line_index && !settings.time_range)
+            line_index_builder.emplace();
+        position.line_index = line_index.get();
+        position.line_index_builder = line_index_builder ? &*line_index_builder : nullptr;
+    }
+
+    // With --since/--until only the lines in the time range are read; line
+    // numbers and index offsets still count from the start of the file.
+    std::unique_ptr<InputSource> source;
+    if (settings.time_range)
+        source = open_input_range(result->path, settings.input_backend, [&](std::string_view contents)
+                                  {
+                                      std::pair<size_t, size_t> range = find_time_range(contents, *settings.time_range);
+                                      position.offset = range.first;
+                                      if (settings.show_line_numbers)
+                                          position.line_number = line_index ? line_index->line_number_at(range.first, contents, 0, 1)
+                                                                            : 1 + count_newlines(contents.data(), contents.data() + range.first);
+                                      return range; });
+    else
+        source = open_input_source(result->path, settings.input_backend);
+    if (settings.stats)
+        ScanStats::add(source ? settings.stats->files_searched : settings.stats->files_skipped, 1);
+    std::optional<MatchIndexEncoder> index;
+    if (settings.pattern_id_of)
+        index.emplace(*settings.pattern_id_of, position.offset);
+    if (source)
+    {
+        Generator<std::string> output_chunks =
+            format_matches(match_blocks(split_line_blocks(read_source_chunks(*source, settings.stats), multiline_mode), settings.match_block, deadline, interrupted),
+                           settings.use_color, settings.show_line_numbers, settings.prefix_paths ? result->path + ":" : "", index ? &*index : nullptr,
+                           position);
+        for (std::string &chunk : output_chunks)
+        {
+            if (!chunk.empty())
+            {
+                if (settings.stats)
+                    ScanStats::add(settings.stats->matched_lines, count_newlines(chunk.data(), chunk.data() + chunk.size()));
+                result->output += chunk;
+                result->found = true;
+            }
+            co_await pool.schedule(priority);
+        }
+    }
+    if (index)
+        result->index_records = std::move(index->records);
+    if (line_index_builder && source && !interrupted)
+        line_index_builder->write(result->path, identity);
+    if (interrupted)
+        result->incomplete_reason = std::string("results truncated, ") + deadline.option_name() + " expired";
+    if (settings.stats)
+        ScanStats::add(settings.stats->files_done, 1);
+    settings.finish(result);
+}
+
+// --- Small-File Batches ---
+// Below SMALL_FILE_SIZE the work around the matcher (a coroutine pipeline,
+// an input source, a pass of the matcher) costs more than the matching, so
+// a directory's files are taken BATCH_FILE_COUNT at a time, the small ones
+// read into one buffer and matched in one pass. A file that does not end in
+// '\n' is followed by one, so the boundaries act as line breaks: no match
+// crosses them, and each goes to the file it starts in. The size is learnt
+// from the open file, so traversal does not stat every entry.
+constexpr size_t SMALL_FILE_SIZE = 4 << 10;
+constexpr size_t BATCH_FILE_COUNT = 256;
+
+// Searches a batch of files on the pool. Larger files found among them are
+// handed to search_file_on_pool; every result is finished as there.
+DetachedTask search_file_batch_on_pool(ThreadPool &pool, std::vector<SearchResult *> files, const FileSearchSettings &settings)
+{
+    co_await pool.schedule(PRIORITY_MATCHING);
+    if (settings.global_deadline.expired())
+    {
+        for (SearchResult *result : files)
+        {
+            result->incomplete_reason = "skipped, --timeout expired";
+            if (settings.stats)
+            {
+                ScanStats::add(settings.stats->files_skipped, 1);
+                ScanStats::add(settings.stats->files_done, 1);
+            }
+            settings.finish(result);
+        }
+        co_return;
+    }
+
+    std::string buffer;
+    std::vector<SearchResult *> batch;
+    std::vector<std::pair<size_t, size_t>> file_ranges; // Each file's bytes in buffer, without an added '\n'
+    for (SearchResult *result : files)
+    {
+        size_t begin = buffer.size();
+        FileAppend append = append_file_contents(result->path, SMALL_FILE_SIZE, buffer);
+        if (append == FILE_APPEND_TOO_LARGE)
+        {
+            search_file_on_pool(pool, PRIORITY_MATCHING, result, settings);
+            continue;
+        }
+        bool opened = append == FILE_APPEND_DONE;
+        batch.push_back(result);
+        file_ranges.emplace_back(begin, buffer.size());
+        if (buffer.size() > begin && buffer.back() != '\n')
+            buffer.push_back('\n');
+        if (settings.stats)
+        {
+            ScanStats::add(opened ? settings.stats->files_searched : settings.stats->files_skipped, 1);
+            ScanStats::add(settings.stats->bytes_by_backend[INPUT_BACKEND_PREAD], file_ranges.back().second - begin);
+        }
+    }
+
+    MatchedBlock matched = match_line_block(buffer, settings.match_block, settings.global_deadline);
+    const std::vector<std::pair<size_t, size_t>> &matches = matched.match_info.matches;
+
+    // An interrupted pass reached at least the file of its last match.
+    size_t first_truncated = batch.size();
+    if (matched.match_info.interrupted)
+    {
+        first_truncated = 0;
+        while (!matches.empty() && first_truncated + 1 < batch.size() && file_ranges[first_truncated + 1].first <= matches.back().first)
+            ++first_truncated;
+    }
+
+    size_t next_match = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        SearchResult *result = batch[i];
+        auto [begin, end] = file_ranges[i];
+        size_t boundary = i + 1 < batch.size() ? file_ranges[i + 1].first : buffer.size();
+        MatchedBlock file_block{std::string_view(buffer).substr(begin, end - begin), MatchInfo{false, {}}};
+        for (; next_match < matches.size() && matches[next_match].first < boundary; ++next_match)
+            file_block.match_info.matches.emplace_back(matches[next_match].first - begin, matches[next_match].second - begin);
+        file_block.match_info.found = !file_block.match_info.matches.empty();
+
+        FilePosition position;
+        result->output = format_matched_block(file_block, settings.use_color, settings.show_line_numbers,
+                                              settings.prefix_paths ? result->path + ":" : "", position);
+        result->found = !result->output.empty();
+        if (settings.pattern_id_of)
+        {
+            MatchIndexEncoder index(*settings.pattern_id_of);
+            index.add_block(file_block.text, file_block.match_info);
+            result->index_records = std::move(index.records);
+        }
+        if (i >= first_truncated)
+            result->incomplete_reason = std::string("results truncated, ") + settings.global_deadline.option_name() + " expired";
+        if (settings.stats)
+        {
+            ScanStats::add(settings.stats->matched_lines, count_newlines(result->output.data(), result->output.data() + result->output.size()));
+            ScanStats::add(settings.stats->files_done, 1);
+        }
+        settings.finish(result);
+    }
+}
+
+// --- Main ---
+// Exit status when a time budget cut the search short: the lines printed are
+// real matches, but some input was not searched.
+constexpr int EXIT_PARTIAL_RESULTS = 2;
+
+int main(int argc, char *argv[])
+{
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::ios::sync_with_stdio(false);
+    std::cout << std::unitbuf;
+    std::cerr << std::unitbuf;
+
+    bool use_recursive_search = false;
+    bool use_color = true;
+    bool show_line_numbers = false;
+    bool use_fixed_strings = false;
+    bool have_pattern_file = false;
+    bool strict_patterns = false;
+    bool cache_first = false;
+    bool show_stats = false;
+    bool show_progress = false;
+    bool follow_files = false;
+    bool use_line_index = false;
+    std::string since_text;
+    std::string until_text;
+    std::string timestamp_format = DEFAULT_TIMESTAMP_FORMAT;
+    std::string index_path;
+    InputBackend input_backend = INPUT_BACKEND_AUTO;
+    double timeout_seconds = 0;
+    double file_timeout_seconds = 0;
+    size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::string regex_pattern_string;
+    std::vector<std::string> pattern_list;
+    std::string token_filter_path;
+    std::string build_token_filter_path;
+    std::string token_delimiter_chars = DEFAULT_TOKEN_DELIMITERS;
+    std::vector<std::string> target_files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "-E")
+        {
+            if (i + 1 < argc)
+            {
+                regex_pattern_string = argv[++i];
+            }
+            else
+            {
+                std::cerr << "Error: -E requires a pattern.\n";
+                return 1;
+            }
+        }
+        else if (arg == "-F" || arg == "--fixed-strings")
+        {
+            use_fixed_strings = true;
+        }
+        else if (arg == "-f")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: -f requires a file.\n";
+                return 1;
+            }
+            std::ifstream pattern_file(argv[++i], std::ios::binary);
+            if (!pattern_file.is_open())
+            {
+                std::cerr << "Error: cannot open pattern file " << argv[i] << ".\n";
+                return 1;
+            }
+            std::string pattern_text;
+            read_stream_contents(pattern_file, pattern_text);
+            if (!pattern_text.empty())
+                split_pattern_lines(pattern_text, pattern_list);
+            have_pattern_file = true;
+        }
+        else if (arg == "-r")
+        {
+            use_recursive_search = true;
+        }
+        else if (arg == "-n" || arg == "--line-number")
+        {
+            show_line_numbers = true;
+        }
+        else if (arg == "-U" || arg == "--multiline")
+        {
+            multiline_mode = true;
+        }
+        else if (arg == "--multiline-dotall")
+        {
+            dot_matches_newline = true;
+        }
+        else if (arg.find("--color=") == 0)
+        {
+            std::string opt = arg.substr(8);
+            use_color = (opt != "never");
+        }
+        else if (arg.find("--token-filter=") == 0)
+        {
+            token_filter_path = arg.substr(15);
+        }
+        else if (arg.find("--build-token-filter=") == 0)
+        {
+            build_token_filter_path = arg.substr(21);
+        }
+        else if (arg.find("--token-delimiters=") == 0)
+        {
+            token_delimiter_chars = arg.substr(19);
+        }
+        else if (arg.find("--threads=") == 0)
+        {
+            try
+            {
+                thread_count = std::stoul(arg.substr(10));
+            }
+            catch (const std::exception &)
+            {
+                thread_count = 0;
+            }
+            if (thread_count == 0)
+            {
+                std::cerr << "Error: --threads requires a positive number.\n";
+                return 1;
+            }
+        }
+        else if (arg == "--strict-patterns")
+        {
+            strict_patterns = true;
+        }
+        else if (arg == "--cache-first")
+        {
+            cache_first = true;
+        }
+        else if (arg.find("--io=") == 0)
+        {
+            if (!parse_input_backend(arg.substr(5), input_backend))
+            {
+                std::cerr << "Error: --io must be one of auto, mmap, pread, read-ahead, io-uring, stream.\n";
+                return 1;
+            }
+        }
+        else if (arg.find("--timeout=") == 0 || arg.find("--file-timeout=") == 0)
+        {
+            size_t value_start = arg.find('=') + 1;
+            double seconds = 0;
+            try
+            {
+                seconds = std::stod(arg.substr(value_start));
+            }
+            catch (const std::exception &)
+            {
+            }
+            if (!(seconds > 0))
+            {
+                std::cerr << "Error: " << arg.substr(0, value_start - 1) << " requires a positive number of seconds.\n";
+                return 1;
+            }
+            if (arg.find("--timeout=") == 0)
+                timeout_seconds = seconds;
+            else
+                file_timeout_seconds = seconds;
+        }
+        else if (arg == "--profile")
+        {
+            enable_profiling = true;
+        }
+        else if (arg == "--stats")
+        {
+            show_stats = true;
+        }
+        else if (arg == "--progress")
+        {
+            show_progress = true;
+        }
+        else if (arg.find("--since=") == 0)
+        {
+            since_text = arg.substr(8);
+        }
+        else if (arg.find("--until=") == 0)
+        {
+            until_text = arg.substr(8);
+        }
+        else if (arg.find("--timestamp-format=") == 0)
+        {
+            timestamp_format = arg.substr(19);
+        }
+        else if (arg == "--follow")
+        {
+            follow_files = true;
+        }
+        else if (arg.find("--emit-index=") == 0)
+        {
+            index_path = arg.substr(13);
+        }
+        else if (arg == "--line-index")
+        {
+            use_line_index = true;
+        }
+        else
+        {
+            target_files.push_back(arg);
+        }
+    }
+
+    if (follow_files && (target_files.empty() || use_recursive_search || multiline_mode))
+    {
+        std::cerr << "Error: --follow requires file arguments and cannot be combined with -r or -U.\n";
+        return 1;
+    }
+
+    // --since and --until bound the lines searched in each file by the
+    // timestamp they begin with.
+    std::optional<TimeRange> time_range;
+    if (!since_text.empty() || !until_text.empty())
+    {
+        if (target_files.empty() || follow_files)
+        {
+            std::cerr << "Error: --since and --until require file arguments and cannot be combined with --follow.\n";
+            return 1;
+        }
+        time_range.emplace();
+        try
+        {
+            time_range->format = parse_timestamp_format(timestamp_format);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        auto parse_bound = [&](const std::string &text, const char *option, Timestamp &bound, bool &has_bound)
+        {
+            if (text.empty())
+                return true;
+            has_bound = parse_timestamp(time_range->format, text, bound, true);
+            if (!has_bound)
+                std::cerr << "Error: " << option << " value " << text << " does not match the timestamp format " << timestamp_format << ".\n";
+            return has_bound;
+        };
+        if (!parse_bound(since_text, "--since", time_range->since, time_range->has_since) ||
+            !parse_bound(until_text, "--until", time_range->until, time_range->has_until))
+            return 1;
+    }
+
+    // --timeout covers the whole run, pattern compilation included.
+    Deadline global_deadline = Deadline::after_seconds(timeout_seconds, "--timeout");
+
+    // -E and -f patterns are combined; each line is its own pattern.
+    if (!have_pattern_file || !regex_pattern_string.empty())
+        split_pattern_lines(regex_pattern_string, pattern_list);
+
+    // Token filters are built once from the literal list and reused by later
+    // searches through --token-filter.
+    TokenDelimiters token_delimiters = make_token_delimiters(token_delimiter_chars);
+    if (!build_token_filter_path.empty())
+    {
+        try
+        {
+            size_t unmatchable_count = write_token_filter(build_token_filter_path, pattern_list, token_delimiters);
+            if (unmatchable_count > 0)
+                std::cerr << "Warning: " << unmatchable_count << " literals contain token delimiters and can never match.\n";
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    TokenFilter token_filter;
+    bool use_token_filter = !token_filter_path.empty();
+    if (use_token_filter)
+    {
+        try
+        {
+            load_token_filter(token_filter_path, token_filter);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    // Fixed strings go to the literal automaton. So does an empty pattern
+    // list (an empty -f file), which must match nothing.
+    bool use_literals = !use_token_filter && (use_fixed_strings || pattern_list.empty());
+    LiteralAutomaton literal_automaton;
+    std::shared_ptr<NFAState> nfa;
+    std::shared_ptr<NFAState> line_filter_nfa;
+    LazyDFA dfa;
+    BacktrackingMatcher backtracking_matcher;
+    bool use_dfa = false;
+    bool use_line_filter = false;
+
+    if (use_literals)
+    {
+        literal_automaton = build_literal_automaton(pattern_list);
+    }
+    else if (!use_token_filter)
+    {
+        std::string combined_pattern;
+        for (const std::string &pattern : pattern_list)
+            combined_pattern += (combined_pattern.empty() ? "" : "|") + pattern;
+
+        // Patterns that may blow up at scan time are reported up front, and
+        // refused outright under --strict-patterns. The checks reuse the
+        // search's NFA and DFA, and only --strict-patterns pays for building
+        // out the DFA.
+        PatternAnalysis analysis;
+        try
+        {
+            nfa = compile_regex_to_nfa(combined_pattern);
+            dfa = build_lazy_dfa(nfa);
+            PatternLimits limits;
+            limits.explore_dfa = strict_patterns;
+            analysis = analyze_pattern(combined_pattern, nfa, dfa, limits);
+            if (strict_patterns && !analysis.acceptable())
+                throw std::runtime_error("pattern rejected by --strict-patterns: " + analysis.warnings.front());
+            for (const std::string &warning : analysis.warnings)
+                std::cerr << "Warning: " << warning << '\n';
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Regex error: " << e.what() << '\n';
+            return 1;
+        }
+
+        use_dfa = !analysis.needs_backtracking;
+        if (!use_dfa)
+        {
+            // dfa then holds the line filter, which cannot see matches
+            // spanning lines.
+            backtracking_matcher = build_backtracking_matcher(nfa);
+            use_line_filter = !multiline_mode;
+            if (use_line_filter)
+            {
+                line_filter_nfa = relax_backreferences(nfa);
+                dfa = build_lazy_dfa(line_filter_nfa);
+            }
+        }
+    }
+
+    // Which pattern a span matched is known exactly for literals (-F and the
+    // token filter, whose ids index its sorted literals) and for a single
+    // pattern; an alternation of several regexes is recorded as 0.
+    std::optional<MatchIndexWriter> index_writer;
+    PatternIdLookup pattern_id_of;
+    std::unordered_map<std::string_view, uint64_t> literal_ids;
+    if (!index_path.empty())
+    {
+        try
+        {
+            index_writer.emplace(index_path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+        if (use_token_filter)
+            pattern_id_of = [&](std::string_view text)
+            {
+                uint64_t literal = token_filter.find(text);
+                return literal < token_filter.literal_count ? literal + 1 : 0;
+            };
+        else if (use_literals)
+        {
+            for (size_t i = 0; i < pattern_list.size(); i++)
+                literal_ids.emplace(pattern_list[i], i + 1);
+            pattern_id_of = [&](std::string_view text)
+            {
+                auto literal = literal_ids.find(text);
+                return literal != literal_ids.end() ? literal->second : 0;
+            };
+        }
+        else
+            pattern_id_of = [single_pattern = pattern_list.size() == 1](std::string_view)
+            { return single_pattern ? uint64_t{1} : uint64_t{0}; };
+    }
+
+    ScanStats scan_stats;
+    ScanStats *stats = show_stats || show_progress ? &scan_stats : nullptr;
+    std::optional<ProgressReporter> progress_reporter;
+    if (show_progress)
+        progress_reporter.emplace(scan_stats);
+    ScanEngine engine = use_token_filter ? SCAN_ENGINE_TOKEN_FILTER
+                        : use_literals   ? SCAN_ENGINE_LITERALS
+                        : use_dfa        ? SCAN_ENGINE_DFA
+                                         : SCAN_ENGINE_BACKTRACKING;
+
+    // Searches a whole block at once. The DFA caches states as it runs, so
+    // every thread brings its own copy.
+    auto match_block = [&](std::string_view block, LazyDFA &search_dfa, const Deadline &deadline)
+    {
+        if (enable_profiling)
+            profiler.lines_processed += count_newlines(block.data(), block.data() + block.size()) + (block.empty() || block.back() != '\n');
+
+        MatchInfo match_info = use_token_filter  ? match_text_with_token_filter(token_filter, token_delimiters, block)
+                               : use_literals    ? match_text_with_literals(literal_automaton, block)
+                               : use_dfa         ? match_text_with_dfa(search_dfa, block)
+                               : use_line_filter ? match_text_with_line_filter(backtracking_matcher, search_dfa, block, deadline)
+                                                 : match_text_with_backtracking(backtracking_matcher, block, deadline);
+        if (stats)
+        {
+            ScanStats::add(stats->bytes_by_engine[engine], block.size());
+            ScanStats::add(stats->prefilter_skipped_bytes, match_info.prefilter_skipped_bytes);
+        }
+        return match_info;
+    };
+
+    bool found_any = false;
+    bool incomplete_any = false;
+
+    if (follow_files)
+    {
+        // Runs on this thread: appended lines arrive a few at a time, which
+        // the pool would only add latency to. Paths prefix the lines when
+        // more than one file is followed.
+        BlockMatcher match_follow_block = [&](std::string_view block, const Deadline &deadline)
+        { return match_block(block, dfa, deadline); };
+        std::vector<FilePosition> positions(target_files.size());
+        bool prefix_paths = target_files.size() > 1;
+        FileFollower follower(target_files);
+        try
+        {
+            follower.run(
+                global_deadline,
+                [&](size_t file, std::string_view lines)
+                {
+                    MatchedBlock block = match_line_block(lines, match_follow_block, global_deadline);
+                    std::string output = format_matched_block(block, use_color, show_line_numbers, prefix_paths ? target_files[file] + ":" : "",
+                                                              positions[file]);
+                    if (stats)
+                        ScanStats::add(stats->matched_lines, count_newlines(output.data(), output.data() + output.size()));
+                    std::cout << output;
+                    found_any = found_any || !output.empty();
+                },
+                [&](size_t file, const char *reason)
+                {
+                    std::cerr << "Warning: " << target_files[file] << ": " << reason << '\n';
+                    positions[file] = {};
+                });
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+    }
+    else if (target_files.empty())
+    {
+        BlockMatcher match_stdin_block = [&](std::string_view block, const Deadline &deadline)
+        { return match_block(block, dfa, deadline); };
+        Deadline file_deadline = Deadline::after_seconds(file_timeout_seconds, "--file-timeout");
+        const Deadline &deadline = Deadline::earliest(global_deadline, file_deadline);
+        bool interrupted = false;
+        std::unique_ptr<InputSource> standard_input = open_standard_input(input_backend);
+        if (stats)
+            ScanStats::add(stats->files_searched, 1);
+        std::optional<MatchIndexEncoder> index;
+        if (index_writer)
+            index.emplace(pattern_id_of);
+        for (const std::string &chunk : format_matches(match_blocks(split_line_blocks(read_source_chunks(*standard_input, stats), multiline_mode),
+                                                                    match_stdin_block, deadline, interrupted),
+                                                       use_color, show_line_numbers, "", index ? &*index : nullptr))
+        {
+            if (stats)
+                ScanStats::add(stats->matched_lines, count_newlines(chunk.data(), chunk.data() + chunk.size()));
+            std::cout << chunk;
+            found_any = found_any || !chunk.empty();
+        }
+        if (stats)
+            ScanStats::add(stats->files_done, 1);
+        if (index && !index->records.empty())
+            index_writer->add_file("(standard input)", index->records);
+        if (interrupted)
+        {
+            std::cerr << "Warning: (standard input): results truncated, " << deadline.option_name() << " expired\n";
+            incomplete_any = true;
+        }
+    }
+    else
+    {
+        // Files are searched on the pool and directories (with -r) are walked
+        // on it as well; output still follows the order of the command line
+        // and of the sorted directory listings.
+        ThreadPool pool(thread_count);
+        std::vector<LazyDFA> worker_dfas(use_dfa || use_line_filter ? pool.worker_count() : 0, dfa);
+        std::mutex profile_mutex;
+        NFAProfiler worker_profile;
+
+        SearchResult root;
+        root.is_directory = true;
+        OrderedOutput ordered_output(&root);
+        ordered_output.index_writer = index_writer ? &*index_writer : nullptr;
+
+        // Workers may take turns on one file, so their profiles are merged
+        // after every block rather than once per file.
+        BlockMatcher match_worker_block = [&](std::string_view block, const Deadline &deadline)
+        {
+            MatchInfo match_info = match_block(block, use_dfa || use_line_filter ? worker_dfas[ThreadPool::current_worker_index()] : dfa, deadline);
+            if (enable_profiling)
+            {
+                std::lock_guard<std::mutex> lock(profile_mutex);
+                worker_profile.merge(profiler);
+                profiler.reset();
+            }
+            return match_info;
+        };
+
+        PrefetchBudget prefetch_budget;
+
+        std::function<void(SearchResult *)> finish_task = [&](SearchResult *result)
+        {
+            prefetch_budget.release(result->prefetched_bytes);
+            if (cache_first)
+            {
+                ordered_output.write_now(result);
+                result->ready.store(true, std::memory_order_release);
+                return;
+            }
+            result->ready.store(true, std::memory_order_release);
+            pool.submit(PRIORITY_OUTPUT, [&]
+                        { ordered_output.flush(); });
+        };
+
+        FileSearchSettings file_search{match_worker_block, use_color, show_line_numbers, use_recursive_search,
+                                       global_deadline, file_timeout_seconds, finish_task, input_backend, stats,
+                                       index_writer ? &pattern_id_of : nullptr, time_range ? &*time_range : nullptr,
+                                       use_line_index};
+
+        std::function<void(SearchResult *)> schedule;
+
+        // --progress estimates the time left from the sizes found so far.
+        auto note_discovered = [&](SearchResult *file)
+        {
+            if (!show_progress)
+                return;
+            std::error_code size_error;
+            uintmax_t file_size = fs::file_size(file->path, size_error);
+            ScanStats::add(scan_stats.files_discovered, 1);
+            ScanStats::add(scan_stats.bytes_discovered, size_error ? 0 : static_cast<size_t>(file_size));
+        };
+
+        // Small files are batched unless something is decided per file: the
+        // cache probe, a time range or timeout, or matches spanning lines.
+        bool batch_small_files = !cache_first && !time_range && file_timeout_seconds == 0 && !multiline_mode;
+
+        auto traverse_directory = [&](SearchResult *directory)
+        {
+            if (global_deadline.expired())
+            {
+                directory->incomplete_reason = "directory skipped, --timeout expired";
+                finish_task(directory);
+                return;
+            }
+            std::vector<fs::directory_entry> listing;
+            std::error_code error;
+            for (fs::directory_iterator it(directory->path, error), end; !error && it != end; it.increment(error))
+                listing.push_back(*it);
+            std::sort(listing.begin(), listing.end(), [](const fs::directory_entry &a, const fs::directory_entry &b)
+                      { return a.path() < b.path(); });
+
+            // Symbolic links are not followed, so the walk cannot loop. Under
+            // --line-index the sidecars are not searched themselves.
+            for (const fs::directory_entry &entry : listing)
+            {
+                fs::file_status status = entry.symlink_status(error);
+                if (error || !(fs::is_directory(status) || fs::is_regular_file(status)))
+                    continue;
+                if (use_line_index && entry.path().extension() == LineIndex::SIDECAR_SUFFIX)
+                    continue;
+                auto result = std::make_unique<SearchResult>();
+                result->path = entry.path().string();
+                result->is_directory = fs::is_directory(status);
+                directory->entries.push_back(std::move(result));
+            }
+
+            std::vector<SearchResult *> batch;
+            for (auto &entry : directory->entries)
+            {
+                if (!batch_small_files || entry->is_directory)
+                {
+                    schedule(entry.get());
+                    continue;
+                }
+                note_discovered(entry.get());
+                batch.push_back(entry.get());
+                if (batch.size() == BATCH_FILE_COUNT)
+                    search_file_batch_on_pool(pool, std::exchange(batch, {}), file_search);
+            }
+            if (!batch.empty())
+                search_file_batch_on_pool(pool, std::move(batch), file_search);
+            finish_task(directory);
+        };
+
+        schedule = [&](SearchResult *result)
+        {
+            if (result->is_directory)
+                pool.submit(PRIORITY_TRAVERSAL, [&, result]
+                            { traverse_directory(result); });
+            else
+            {
+                note_discovered(result);
+
+                // With --cache-first, files already in the page cache are
+                // searched before cold ones, which are prefetched meanwhile.
+                TaskPriority priority = PRIORITY_MATCHING;
+                if (cache_first)
+                {
+                    size_t prefetch_limit = prefetch_budget.reserve();
+                    PageCacheProbe probe = probe_page_cache(result->path, prefetch_limit);
+                    prefetch_budget.release(prefetch_limit - probe.prefetched_bytes);
+                    result->prefetched_bytes = probe.prefetched_bytes;
+                    if (!probe.resident)
+                        priority = PRIORITY_DEFERRED_MATCHING;
+                }
+                search_file_on_pool(pool, priority, result, file_search);
+            }
+        };
+
+        for (const auto &f : target_files)
+        {
+            auto result = std::make_unique<SearchResult>();
+            result->path = f;
+            result->is_directory = use_recursive_search && fs::is_directory(f);
+            root.entries.push_back(std::move(result));
+        }
+        root.ready.store(true, std::memory_order_release);
+        for (auto &entry : root.entries)
+            schedule(entry.get());
+
+        pool.wait_idle();
+        ordered_output.flush();
+        found_any = ordered_output.found_any;
+        incomplete_any = ordered_output.incomplete_any;
+        profiler.merge(worker_profile);
+    }
+
+    if (enable_profiling)
+    {
+        std::cerr << "\n[Regex Profiler Summary]\n"
+                  << "  Lines processed      : " << profiler.lines_processed << "\n"
+                  << "  Total simulation steps: " << profiler.total_steps << "\n"
+                  << "  Total states visited : " << profiler.total_states_visited << "\n"
+                  << "  Max active states     : " << profiler.max_active_states << "\n"
+                  << "  DFA states built     : " << profiler.dfa_states_built << "\n"
+                  << "  DFA cache resets     : " << profiler.dfa_cache_resets << "\n";
+        if (use_token_filter)
+        {
+            std::cerr << "  Filter literals      : " << token_filter.literal_count << "\n"
+                      << "  Filter bytes         : " << token_filter.file_size << "\n";
+        }
+        if (use_literals)
+        {
+            std::cerr << "  Literals             : " << literal_automaton.literal_count << "\n"
+                      << "  Automaton states     : " << literal_automaton.state_count
+                      << (literal_automaton.uses_resolved_transitions() ? " (resolved DFA)" : " (double array + failure links)") << "\n"
+                      << "  Automaton bytes      : " << literal_automaton.memory_bytes() << "\n"
+                      << "  Prefilter bytes      : " << literal_automaton.rare_bytes.size() << "\n";
+        }
+    }
+
+    progress_reporter.reset();
+    if (index_writer)
+    {
+        try
+        {
+            index_writer->close();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+    }
+    if (show_stats)
+        std::cerr << format_scan_stats(scan_stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count()) << '\n';
+
+    if (incomplete_any)
+        return EXIT_PARTIAL_RESULTS;
+    return !found_any;
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "match_index.hpp"
+
+#include <stdexcept>
+
+void append_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void MatchIndexEncoder::add_block(std::string_view block, const MatchInfo &match_info)
+{
+    for (const auto &[start, end] : match_info.matches)
+    {
+        uint64_t offset = block_offset + start;
+        append_varint(records, MATCH_INDEX_MATCH);
+        append_varint(records, offset - previous_match);
+        append_varint(records, end - start);
+        append_varint(records, pattern_id_of(block.substr(start, end - start)));
+        previous_match = offset;
+    }
+    block_offset += block.size();
+}
+
+MatchIndexWriter::MatchIndexWriter(const std::string &path) : path(path), out(path, std::ios::binary | std::ios::trunc)
+{
+    if (!out.is_open())
+        throw std::runtime_error("cannot create index file " + path);
+    std::string header(MATCH_INDEX_MAGIC, sizeof(MATCH_INDEX_MAGIC));
+    append_varint(header, MATCH_INDEX_VERSION);
+    out << header;
+}
+
+void MatchIndexWriter::add_file(std::string_view file_path, std::string_view match_records)
+{
+    std::string file_record;
+    append_varint(file_record, MATCH_INDEX_FILE);
+    append_varint(file_record, file_path.size());
+    file_record += file_path;
+    out << file_record << match_records;
+}
+
+void MatchIndexWriter::close()
+{
+    out.close();
+    if (!out)
+        throw std::runtime_error("failed writing index file " + path);
+}
+
+MatchIndexReader::MatchIndexReader(const std::string &path) : path(path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        throw std::runtime_error("cannot open index file " + path);
+    read_stream_contents(in, data);
+    if (data.compare(0, sizeof(MATCH_INDEX_MAGIC), MATCH_INDEX_MAGIC, sizeof(MATCH_INDEX_MAGIC)) != 0)
+        throw std::runtime_error("not an index file: " + path);
+    position = sizeof(MATCH_INDEX_MAGIC);
+    if (read_varint() != MATCH_INDEX_VERSION)
+        throw std::runtime_error("unsupported index version: " + path);
+}
+
+uint64_t MatchIndexReader::read_varint()
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (position == data.size())
+            throw std::runtime_error("truncated index file " + path);
+        unsigned char byte = static_cast<unsigned char>(data[position++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("corrupt index file " + path);
+}
+
+bool MatchIndexReader::next(IndexedMatch &match)
+{
+    while (position < data.size())
+    {
+        uint64_t tag = read_varint();
+        if (tag == MATCH_INDEX_FILE)
+        {
+            uint64_t length = read_varint();
+            if (length > data.size() - position)
+                throw std::runtime_error("truncated index file " + path);
+            file_paths.push_back(data.substr(position, length));
+            position += length;
+            previous_match = 0;
+        }
+        else if (tag == MATCH_INDEX_MATCH && !file_paths.empty())
+        {
+            match.file_id = file_paths.size() - 1;
+            match.offset = previous_match + read_varint();
+            match.length = read_varint();
+            match.pattern_id = read_varint();
+            previous_match = match.offset;
+            return true;
+        }
+        else
+            throw std::runtime_error("corrupt index file " + path);
+    }
+    return false;
+}
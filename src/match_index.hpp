@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "grep_engine.hpp"
+
+// --- Match Index (--emit-index) ---
+// A compact binary record of every match span, so later tools can seek
+// straight to matches instead of parsing printed lines. The file starts with
+// the magic "GMIX" and a varint format version, followed by records, each a
+// varint tag and varint fields:
+//   FILE   path length, path bytes           starts the matches of the next
+//                                            file; the n-th FILE is file id n
+//   MATCH  offset delta, length, pattern id  offset is in bytes from the start
+//                                            of the file, stored as the
+//                                            difference from the previous
+//                                            match of the same file
+// Pattern ids are 1 + the index of the matching pattern, or 0 where the
+// engine cannot tell which of several patterns matched.
+constexpr char MATCH_INDEX_MAGIC[4] = {'G', 'M', 'I', 'X'};
+constexpr uint64_t MATCH_INDEX_VERSION = 1;
+
+enum MatchIndexTag
+{
+    MATCH_INDEX_FILE = 1,
+    MATCH_INDEX_MATCH = 2
+};
+
+void append_varint(std::string &out, uint64_t value);
+
+// Maps matched text to its pattern id.
+using PatternIdLookup = std::function<uint64_t(std::string_view matched_text)>;
+
+// Encodes the MATCH records of one input, block by block. Every block must
+// be passed, matched or not, so offsets stay file-relative; first_offset is
+// where the first block starts when only part of the file is searched.
+class MatchIndexEncoder
+{
+public:
+    explicit MatchIndexEncoder(const PatternIdLookup &pattern_id_of, uint64_t first_offset = 0)
+        : pattern_id_of(pattern_id_of), block_offset(first_offset)
+    {
+    }
+
+    void add_block(std::string_view block, const MatchInfo &match_info);
+
+    std::string records;
+
+private:
+    const PatternIdLookup &pattern_id_of;
+    uint64_t block_offset = 0;
+    uint64_t previous_match = 0;
+};
+
+// Writes an index file. Throws std::runtime_error if it cannot be created or
+// written.
+class MatchIndexWriter
+{
+public:
+    explicit MatchIndexWriter(const std::string &path);
+
+    // Appends a FILE record for path and then its MATCH records.
+    void add_file(std::string_view path, std::string_view match_records);
+    void close();
+
+private:
+    std::string path;
+    std::ofstream out;
+};
+
+struct IndexedMatch
+{
+    uint64_t file_id = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint64_t pattern_id = 0;
+};
+
+// Reads an index file written by --emit-index. Throws std::runtime_error if
+// the file cannot be read or is not a valid index.
+class MatchIndexReader
+{
+public:
+    explicit MatchIndexReader(const std::string &path);
+
+    // Reads the next match; false at the end of the index.
+    bool next(IndexedMatch &match);
+
+    // Paths of the files seen so far, by file id.
+    const std::vector<std::string> &files() const { return file_paths; }
+
+private:
+    uint64_t read_varint();
+
+    std::string path;
+    std::string data;
+    size_t position = 0;
+    std::vector<std::string> file_paths;
+    uint64_t previous_match = 0;
+};
@@ -0,0 +1,98 @@
+#include "page_cache.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_MINCORE 1
+#endif
+
+namespace
+{
+    constexpr size_t RESIDENCY_PROBE_BYTES = 64 << 20;
+    constexpr double RESIDENT_FRACTION = 0.9;
+}
+
+bool pages_resident(int fd, size_t begin, size_t end)
+{
+    bool resident = true;
+#if defined(GREP_HAS_MINCORE)
+    // Mappings start on a page boundary.
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t probe_begin = begin - begin % page_size;
+    size_t probe_length = end > begin ? std::min(end - probe_begin, RESIDENCY_PROBE_BYTES) : 0;
+    if (probe_length == 0)
+        return resident;
+    void *mapping = mmap(nullptr, probe_length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(probe_begin));
+    if (mapping != MAP_FAILED)
+    {
+        size_t page_count = (probe_length + page_size - 1) / page_size;
+#if defined(__APPLE__)
+        std::vector<char> page_flags(page_count);
+#else
+        std::vector<unsigned char> page_flags(page_count);
+#endif
+        if (mincore(mapping, probe_length, page_flags.data()) == 0)
+        {
+            size_t resident_pages = std::count_if(page_flags.begin(), page_flags.end(), [](auto flags)
+                                                  { return (flags & 1) != 0; });
+            resident = resident_pages >= RESIDENT_FRACTION * page_count;
+        }
+        munmap(mapping, probe_length);
+    }
+#else
+    (void)fd;
+    (void)begin;
+    (void)end;
+#endif
+    return resident;
+}
+
+PageCacheProbe probe_page_cache(const std::string &path, size_t prefetch_limit)
+{
+    PageCacheProbe probe;
+#if defined(GREP_HAS_MINCORE)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return probe;
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0 || !S_ISREG(file_status.st_mode) || file_status.st_size == 0)
+    {
+        close(fd);
+        return probe;
+    }
+
+    size_t file_size = static_cast<size_t>(file_status.st_size);
+    probe.resident = pages_resident(fd, 0, file_size);
+
+#if defined(POSIX_FADV_WILLNEED)
+    if (!probe.resident && prefetch_limit > 0)
+    {
+        probe.prefetched_bytes = std::min(file_size, prefetch_limit);
+        posix_fadvise(fd, 0, static_cast<off_t>(probe.prefetched_bytes), POSIX_FADV_WILLNEED);
+    }
+#else
+    (void)prefetch_limit;
+#endif
+    close(fd);
+#else
+    (void)path;
+    (void)prefetch_limit;
+#endif
+    return probe;
+}
+
+size_t PrefetchBudget::reserve()
+{
+    size_t current = available.load(std::memory_order_relaxed);
+    size_t taken;
+    do
+    {
+        taken = std::min(current, BYTES_PER_FILE);
+    } while (!available.compare_exchange_weak(current, current - taken, std::memory_order_relaxed));
+    return taken;
+}
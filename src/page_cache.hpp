@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+// --- Page Cache Residency (--cache-first) ---
+// Tells files already in the page cache from cold ones, so cached files can
+// be searched first while the kernel starts reading the cold ones.
+struct PageCacheProbe
+{
+    bool resident = true; // Files that cannot be probed count as resident and are not held back
+    size_t prefetched_bytes = 0;
+};
+
+// Whether most of the first 64 MiB of bytes [begin, end) of the open regular
+// file fd are in the page cache. True where this cannot be checked.
+bool pages_resident(int fd, size_t begin, size_t end);
+
+// Checks with mincore whether most of the first 64 MiB of path are cached.
+// A cold file has its first prefetch_limit bytes handed to the kernel with
+// POSIX_FADV_WILLNEED, which starts reading them in the background.
+PageCacheProbe probe_page_cache(const std::string &path, size_t prefetch_limit);
+
+// Caps how much cold data is prefetched but not yet searched, so prefetching
+// a large tree cannot evict the files it was meant to warm up.
+class PrefetchBudget
+{
+public:
+    static constexpr size_t TOTAL_BYTES = 256 << 20;
+    static constexpr size_t BYTES_PER_FILE = 8 << 20;
+
+    // Takes up to BYTES_PER_FILE from the budget and returns the amount taken.
+    size_t reserve();
+    void release(size_t bytes) { available.fetch_add(bytes, std::memory_order_relaxed); }
+
+private:
+    std::atomic<size_t> available{TOTAL_BYTES};
+};
@@ -0,0 +1,426 @@
+#include "pattern_analyzer.hpp"
+
+#include "backtracking_matcher.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+    bool is_backreference(const NFAState &state)
+    {
+        return state.character_code >= OPCODE_BACKREF_START && state.character_code < OPCODE_MATCHED;
+    }
+
+    bool is_consuming(const NFAState &state)
+    {
+        switch (state.character_code)
+        {
+        case OPCODE_SPLIT:
+        case OPCODE_MATCH_START:
+        case OPCODE_MATCH_END:
+        case OPCODE_MATCHED:
+            return false;
+        default:
+            return !is_backreference(state);
+        }
+    }
+
+    // Counts '|' outside escapes and bracket expressions.
+    size_t count_alternatives(std::string_view pattern)
+    {
+        size_t alternatives = 1;
+        bool in_brackets = false;
+        for (size_t i = 0; i < pattern.size(); ++i)
+        {
+            if (pattern[i] == '\\')
+                ++i;
+            else if (pattern[i] == '[')
+                in_brackets = true;
+            else if (pattern[i] == ']')
+                in_brackets = false;
+            else if (pattern[i] == '|' && !in_brackets)
+                alternatives++;
+        }
+        return alternatives;
+    }
+
+    // Builds every DFA state reachable from the start states, breadth first,
+    // until the pattern is exhausted, limit states exist or the work budget
+    // (NFA ids scanned while computing transitions) runs out.
+    void explore_dfa(LazyDFA &dfa, size_t limit, PatternAnalysis &analysis)
+    {
+        for (int unanchored = 0; unanchored < 2; ++unanchored)
+            for (int at_line_start = 0; at_line_start < 2; ++at_line_start)
+                dfa_start_row(dfa, start_key_flags(dfa, unanchored, at_line_start));
+
+        // Stop short of the cache size: a reset would renumber the rows.
+        limit = std::min(limit + LazyDFA::ACCELERATED_START_STATE, LazyDFA::MAX_CACHED_STATES - 1);
+        size_t work = 0;
+        for (size_t state_index = LazyDFA::ACCELERATED_START_STATE; state_index < dfa.state_keys.size(); ++state_index)
+        {
+            uint32_t row = dfa.row_of(static_cast<uint32_t>(state_index));
+            for (uint32_t class_index = 0; class_index < dfa.class_count; ++class_index)
+            {
+                if (dfa.state_keys.size() >= limit || work > PatternAnalysis::MAX_EXPLORATION_WORK)
+                {
+                    analysis.dfa_limit_reached = true;
+                    analysis.dfa_states_explored = dfa.state_keys.size() - LazyDFA::ACCELERATED_START_STATE;
+                    return;
+                }
+                if (dfa.transitions[row + class_index] == dfa.row_of(LazyDFA::UNKNOWN_STATE))
+                {
+                    work += dfa.state_keys[state_index].size();
+                    compute_dfa_transition(dfa, row, class_index);
+                }
+            }
+        }
+        analysis.dfa_states_explored = dfa.state_keys.size() - LazyDFA::ACCELERATED_START_STATE;
+    }
+
+    // Largest set of NFA states in a built DFA state, leaving out the flags
+    // that head each key.
+    size_t largest_dfa_state(const LazyDFA &dfa)
+    {
+        size_t largest = 0;
+        for (size_t state_index = LazyDFA::ACCELERATED_START_STATE; state_index < dfa.state_keys.size(); ++state_index)
+            largest = std::max(largest, dfa.state_keys[state_index].size() - 1);
+        return largest;
+    }
+
+    struct Successor
+    {
+        int consuming_index;
+        bool has_two_paths; // Reached through more than one epsilon path
+    };
+
+    // Consuming states reachable from state without reading input, counting
+    // epsilon paths up to two. Each non-consuming state is expanded at most
+    // twice, so epsilon cycles terminate and show up as repeated paths.
+    std::vector<Successor> epsilon_successors(const NFAState *state, const std::vector<NFAState *> &nfa_states,
+                                              const std::vector<int> &consuming_index)
+    {
+        std::vector<uint8_t> path_count(nfa_states.size(), 0);
+        std::vector<const NFAState *> pending_states = {state};
+        while (!pending_states.empty())
+        {
+            const NFAState *current = pending_states.back();
+            pending_states.pop_back();
+            if (!current || path_count[current->state_id] >= 2)
+                continue;
+            path_count[current->state_id]++;
+            if (is_consuming(*current) || current->character_code == OPCODE_MATCHED)
+                continue;
+            pending_states.push_back(current->primary_transition);
+            if (current->character_code == OPCODE_SPLIT)
+                pending_states.push_back(current->alternative_transition);
+        }
+
+        std::vector<Successor> successors;
+        for (size_t state_id = 0; state_id < nfa_states.size(); ++state_id)
+        {
+            if (path_count[state_id] > 0 && consuming_index[state_id] >= 0)
+                successors.push_back({consuming_index[state_id], path_count[state_id] >= 2});
+        }
+        return successors;
+    }
+
+    // Iterative Tarjan over a graph in compressed adjacency form: the edges
+    // of node n are edge_target[edge_begin[n]] up to edge_begin[n + 1].
+    // Sets component[node] for every node and returns the component count.
+    uint32_t find_strong_components(const std::vector<uint32_t> &edge_begin, const std::vector<uint32_t> &edge_target,
+                                    std::vector<uint32_t> &component)
+    {
+        constexpr uint32_t UNVISITED = UINT32_MAX;
+        uint32_t node_count = static_cast<uint32_t>(edge_begin.size() - 1);
+        std::vector<uint32_t> order(node_count, UNVISITED), low_link(node_count, 0);
+        component.assign(node_count, UNVISITED);
+        std::vector<uint32_t> scc_stack, call_stack, next_edge(node_count, 0);
+        uint32_t next_order = 0, component_count = 0;
+        for (uint32_t root = 0; root < node_count; ++root)
+        {
+            if (order[root] != UNVISITED)
+                continue;
+            call_stack.push_back(root);
+            while (!call_stack.empty())
+            {
+                uint32_t node = call_stack.back();
+                if (order[node] == UNVISITED)
+                {
+                    order[node] = low_link[node] = next_order++;
+                    next_edge[node] = edge_begin[node];
+                    scc_stack.push_back(node);
+                }
+                if (next_edge[node] < edge_begin[node + 1])
+                {
+                    uint32_t target = edge_target[next_edge[node]++];
+                    if (order[target] == UNVISITED)
+                        call_stack.push_back(target);
+                    else if (component[target] == UNVISITED)
+                        low_link[node] = std::min(low_link[node], order[target]);
+                    continue;
+                }
+                call_stack.pop_back();
+                if (!call_stack.empty())
+                    low_link[call_stack.back()] = std::min(low_link[call_stack.back()], low_link[node]);
+                if (low_link[node] == order[node])
+                {
+                    uint32_t member;
+                    do
+                    {
+                        member = scc_stack.back();
+                        scc_stack.pop_back();
+                        component[member] = component_count;
+                    } while (member != node);
+                    component_count++;
+                }
+            }
+        }
+        return component_count;
+    }
+
+    // Bound on the NFA states active after one byte, from closure sizes: the
+    // start closure, which an unanchored search adds at every position, the
+    // largest closure entered by consuming a byte, and every consuming state
+    // on a loop, since those can stay active while other closures come and
+    // go. Returns 0 if enumerating the closures takes more than
+    // MAX_EXPLORATION_WORK steps.
+    size_t closure_active_state_bound(const std::vector<NFAState *> &nfa_states, const NFAState *start_state)
+    {
+        size_t state_count = nfa_states.size();
+        std::vector<uint32_t> visited_in(state_count, 0); // Number of the last closure that reached each state
+        uint32_t closure_number = 0;
+        size_t work = 0;
+        std::vector<const NFAState *> pending_states;
+        auto closure_size = [&](const NFAState *state)
+        {
+            closure_number++;
+            size_t size = 0;
+            pending_states.assign(1, state);
+            while (!pending_states.empty() && work <= PatternAnalysis::MAX_EXPLORATION_WORK)
+            {
+                const NFAState *current = pending_states.back();
+                pending_states.pop_back();
+                if (!current || visited_in[current->state_id] == closure_number)
+                    continue;
+                visited_in[current->state_id] = closure_number;
+                work++;
+                int code = current->character_code;
+                if (code == OPCODE_SPLIT || code == OPCODE_MATCH_START || code == OPCODE_MATCH_END)
+                {
+                    pending_states.push_back(current->primary_transition);
+                    pending_states.push_back(current->alternative_transition);
+                    continue;
+                }
+                size++;
+            }
+            return size;
+        };
+
+        size_t start_closure = closure_size(start_state);
+        size_t largest_closure = 0;
+        for (const NFAState *state : nfa_states)
+        {
+            if (is_consuming(*state) || is_backreference(*state))
+                largest_closure = std::max(largest_closure, closure_size(state->primary_transition));
+        }
+        if (work > PatternAnalysis::MAX_EXPLORATION_WORK)
+            return 0;
+
+        std::vector<uint32_t> edge_begin(state_count + 1, 0);
+        std::vector<uint32_t> edge_target;
+        for (size_t state_id = 0; state_id < state_count; ++state_id)
+        {
+            for (const NFAState *next_state : {nfa_states[state_id]->primary_transition, nfa_states[state_id]->alternative_transition})
+            {
+                if (next_state)
+                    edge_target.push_back(static_cast<uint32_t>(next_state->state_id));
+            }
+            edge_begin[state_id + 1] = static_cast<uint32_t>(edge_target.size());
+        }
+        std::vector<uint32_t> component;
+        uint32_t component_count = find_strong_components(edge_begin, edge_target, component);
+        std::vector<uint32_t> component_size(component_count, 0);
+        for (uint32_t state_component : component)
+            component_size[state_component]++;
+        size_t loop_states = std::count_if(nfa_states.begin(), nfa_states.end(), [&](const NFAState *state)
+                                           { return is_consuming(*state) && component_size[component[state->state_id]] > 1; });
+
+        return std::min(start_closure + largest_closure + loop_states, state_count);
+    }
+
+    // Exponential degree of ambiguity: some state p can return to itself
+    // along two different paths that read the same string. In the product
+    // automaton (pairs of states reading a common byte) that means a strongly
+    // connected component holding a diagonal pair (p, p) together with an
+    // off-diagonal pair, or a diagonal edge with two epsilon paths behind it.
+    bool has_exponential_ambiguity(const std::vector<NFAState *> &nfa_states)
+    {
+        std::vector<int> consuming_index(nfa_states.size(), -1);
+        std::vector<const NFAState *> consuming_states;
+        for (const NFAState *state : nfa_states)
+        {
+            if (is_consuming(*state))
+            {
+                consuming_index[state->state_id] = static_cast<int>(consuming_states.size());
+                consuming_states.push_back(state);
+            }
+        }
+
+        // A possessive quantifier consumes a run in exactly one way, so its
+        // state only continues past the group, never back into its own loop.
+        std::vector<const NFAState *> continuation(nfa_states.size(), nullptr);
+        for (const AtomicGroup &group : find_atomic_groups(nfa_states))
+        {
+            if (group.repeated_state)
+                continuation[group.repeated_state->state_id] = group.end_marker;
+        }
+
+        size_t state_count = consuming_states.size();
+        std::vector<std::bitset<256>> accepted_bytes(state_count);
+        std::vector<std::vector<Successor>> successors(state_count);
+        for (size_t p = 0; p < state_count; ++p)
+        {
+            const NFAState *state = consuming_states[p];
+            for (int byte = 0; byte < 256; ++byte)
+                accepted_bytes[p][byte] = state_accepts_character(*state, static_cast<char>(byte));
+            const NFAState *next_state = continuation[state->state_id] ? continuation[state->state_id] : state->primary_transition;
+            successors[p] = epsilon_successors(next_state, nfa_states, consuming_index);
+        }
+
+        // Product graph in compressed adjacency form; node (p, q) is p * n + q.
+        size_t node_count = state_count * state_count;
+        std::vector<uint32_t> edge_begin(node_count + 1, 0);
+        std::vector<uint32_t> edge_target;
+        std::vector<std::pair<uint32_t, uint32_t>> repeated_edges;
+        for (size_t p = 0; p < state_count; ++p)
+        {
+            for (size_t q = 0; q < state_count; ++q)
+            {
+                uint32_t node = static_cast<uint32_t>(p * state_count + q);
+                if ((accepted_bytes[p] & accepted_bytes[q]).any())
+                {
+                    for (const Successor &next_p : successors[p])
+                    {
+                        for (const Successor &next_q : successors[q])
+                        {
+                            uint32_t target = static_cast<uint32_t>(next_p.consuming_index * state_count + next_q.consuming_index);
+                            edge_target.push_back(target);
+                            if (p == q && next_p.consuming_index == next_q.consuming_index && next_p.has_two_paths)
+                                repeated_edges.push_back({node, target});
+                        }
+                    }
+                }
+                edge_begin[node + 1] = static_cast<uint32_t>(edge_target.size());
+            }
+        }
+
+        std::vector<uint32_t> component;
+        uint32_t component_count = find_strong_components(edge_begin, edge_target, component);
+
+        for (const auto &[source, target] : repeated_edges)
+        {
+            if (component[source] == component[target])
+                return true;
+        }
+        std::vector<uint8_t> has_diagonal(component_count, 0), has_off_diagonal(component_count, 0);
+        for (uint32_t node = 0; node < node_count; ++node)
+        {
+            if (node / state_count == node % state_count)
+                has_diagonal[component[node]] = 1;
+            else
+                has_off_diagonal[component[node]] = 1;
+        }
+        for (uint32_t index = 0; index < component_count; ++index)
+        {
+            if (has_diagonal[index] && has_off_diagonal[index])
+                return true;
+        }
+        return false;
+    }
+}
+
+PatternAnalysis analyze_pattern(std::string_view pattern, const PatternLimits &limits)
+{
+    // Analysis builds its own NFA and DFA; keep them out of the search profile.
+    NFAProfiler saved_profiler = profiler;
+    std::shared_ptr<NFAState> nfa = compile_regex_to_nfa(pattern);
+    LazyDFA dfa = build_lazy_dfa(nfa);
+    profiler = saved_profiler;
+    return analyze_pattern(pattern, nfa, dfa, limits);
+}
+
+PatternAnalysis analyze_pattern(std::string_view pattern, const std::shared_ptr<NFAState> &nfa, LazyDFA &dfa,
+                                const PatternLimits &limits)
+{
+    PatternAnalysis analysis;
+    analysis.alternative_count = count_alternatives(pattern);
+
+    // States explored here are not ones the search built.
+    NFAProfiler saved_profiler = profiler;
+    analysis.nfa_state_count = dfa.nfa_states.size();
+    analysis.needs_backtracking = nfa_needs_backtracking(dfa.nfa_states);
+    analysis.max_active_states = closure_active_state_bound(dfa.nfa_states, nfa.get());
+    analysis.active_state_bound = ACTIVE_BOUND_CLOSURES;
+    if (analysis.max_active_states == 0)
+    {
+        analysis.max_active_states = std::count_if(dfa.nfa_states.begin(), dfa.nfa_states.end(), [](const NFAState *state)
+                                                   { return state->character_code != OPCODE_SPLIT; });
+        analysis.active_state_bound = ACTIVE_BOUND_NFA_SIZE;
+    }
+
+    // The DFA is only used when no backtracking is needed; otherwise the cost
+    // that can explode is the number of paths through the pattern. A fully
+    // explored DFA gives the exact bound: each of its states is one set of
+    // NFA states that can be active together.
+    if (!analysis.needs_backtracking && limits.explore_dfa)
+    {
+        explore_dfa(dfa, limits.max_dfa_states, analysis);
+        if (!analysis.dfa_limit_reached)
+        {
+            analysis.max_active_states = largest_dfa_state(dfa);
+            analysis.active_state_bound = ACTIVE_BOUND_DFA;
+        }
+    }
+    else if (analysis.needs_backtracking)
+    {
+        size_t consuming_count = std::count_if(dfa.nfa_states.begin(), dfa.nfa_states.end(), [](const NFAState *state)
+                                               { return is_consuming(*state); });
+        analysis.ambiguity_checked = consuming_count <= PatternAnalysis::MAX_AMBIGUITY_STATES;
+        if (analysis.ambiguity_checked)
+            analysis.exponentially_ambiguous = has_exponential_ambiguity(dfa.nfa_states);
+    }
+    profiler = saved_profiler;
+
+    if (analysis.alternative_count > limits.max_alternatives)
+        analysis.warnings.push_back(std::to_string(analysis.alternative_count) + " alternatives exceed the limit of " +
+                                    std::to_string(limits.max_alternatives) + " (use -F for literal lists)");
+    if (analysis.max_active_states > limits.max_active_states)
+    {
+        std::string count = std::to_string(analysis.max_active_states);
+        std::string limit = " exceed the limit of " + std::to_string(limits.max_active_states);
+        if (analysis.active_state_bound == ACTIVE_BOUND_DFA)
+            analysis.warnings.push_back("up to " + count + " active NFA states per byte" + limit);
+        else if (analysis.active_state_bound == ACTIVE_BOUND_CLOSURES)
+            analysis.warnings.push_back("an estimated " + count + " active NFA states per byte" + limit);
+        else
+            analysis.warnings.push_back(count + " NFA states, too many to bound the active states per byte," + limit);
+    }
+    if (analysis.dfa_limit_reached)
+        analysis.warnings.push_back("pattern expands to more than " + std::to_string(analysis.dfa_states_explored) + " DFA states");
+    if (analysis.exponentially_ambiguous)
+        analysis.warnings.push_back("nested or overlapping quantifiers make backtracking exponential");
+    else if (analysis.needs_backtracking && !analysis.ambiguity_checked)
+        analysis.warnings.push_back("pattern is too large to check for exponential backtracking");
+    return analysis;
+}
+
+void require_acceptable_pattern(std::string_view pattern, const PatternLimits &limits)
+{
+    PatternAnalysis analysis = analyze_pattern(pattern, limits);
+    if (!analysis.acceptable())
+        throw std::runtime_error("pattern rejected: " + analysis.warnings.front());
+}
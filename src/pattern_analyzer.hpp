@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grep_engine.hpp"
+
+// --- Pattern Complexity Analysis (--strict-patterns) ---
+// Static checks run on a pattern before any input is read. The set engines
+// (lazy DFA, NFA simulation) are linear in the input, but their constant
+// factor depends on how many NFA states can be active at once and on how many
+// DFA states the pattern expands to. Backreferences and atomic groups need
+// the backtracking matcher, where ambiguous nested quantifiers make matching
+// exponential.
+struct PatternLimits
+{
+    size_t max_active_states = 2000;                       // NFA states one input byte may visit
+    size_t max_dfa_states = LazyDFA::MAX_CACHED_STATES / 2; // Explored DFA states before warning
+    size_t max_alternatives = 1000;                        // Top-level and nested '|' branches
+    bool explore_dfa = true;                               // Build out the DFA; by far the costliest check
+};
+
+// Where PatternAnalysis::max_active_states comes from, most exact first.
+enum ActiveStateBound
+{
+    ACTIVE_BOUND_DFA,      // Largest DFA state, with every state explored
+    ACTIVE_BOUND_CLOSURES, // Start closure, largest other closure and the states on loops
+    ACTIVE_BOUND_NFA_SIZE  // Every non-split state; the closures were too large to enumerate
+};
+
+struct PatternAnalysis
+{
+    static constexpr size_t MAX_AMBIGUITY_STATES = 128;     // Product automaton is quadratic in this
+    static constexpr size_t MAX_EXPLORATION_WORK = 1 << 22; // NFA ids scanned while exploring the DFA
+
+    size_t nfa_state_count = 0;
+    size_t max_active_states = 0; // Bound on the NFA states active after one byte
+    ActiveStateBound active_state_bound = ACTIVE_BOUND_NFA_SIZE;
+    size_t alternative_count = 1;
+    size_t dfa_states_explored = 0;
+    bool dfa_limit_reached = false;
+    bool needs_backtracking = false;
+    bool ambiguity_checked = false;
+    bool exponentially_ambiguous = false; // Some input has exponentially many match paths
+    std::vector<std::string> warnings;    // One line per exceeded limit
+
+    bool acceptable() const { return warnings.empty(); }
+};
+
+// Compiles pattern and measures it against limits. Throws std::runtime_error
+// on syntax errors, exactly like compile_regex_to_nfa.
+PatternAnalysis analyze_pattern(std::string_view pattern, const PatternLimits &limits = {});
+
+// Measures nfa, already compiled from pattern, and dfa, built from nfa,
+// without compiling again. Exploring the DFA leaves its states cached in
+// dfa, where a search can reuse them.
+PatternAnalysis analyze_pattern(std::string_view pattern, const std::shared_ptr<NFAState> &nfa, LazyDFA &dfa,
+                                const PatternLimits &limits = {});
+
+// Like analyze_pattern, but throws std::runtime_error naming the first
+// exceeded limit instead of returning a warning.
+void require_acceptable_pattern(std::string_view pattern, const PatternLimits &limits = {});
@@ -0,0 +1,208 @@
+#include "read_ahead.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_POSIX_IO 1
+#endif
+
+namespace
+{
+    char *allocate_aligned(size_t size)
+    {
+        size_t rounded_size = (size + ReadAheadReader::BUFFER_ALIGNMENT - 1) / ReadAheadReader::BUFFER_ALIGNMENT * ReadAheadReader::BUFFER_ALIGNMENT;
+        return static_cast<char *>(std::aligned_alloc(ReadAheadReader::BUFFER_ALIGNMENT, rounded_size));
+    }
+}
+
+void ReadAheadReader::AlignedFree::operator()(char *data) const
+{
+    std::free(data);
+}
+
+ReadAheadReader::ReadAheadReader(const std::string &path)
+{
+    bool use_io_thread = false;
+    size_t sync_buffer_size = INITIAL_BLOCK_SIZE;
+
+#if defined(GREP_HAS_POSIX_IO)
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat file_status;
+    if (fstat(fd, &file_status) == 0 && S_ISREG(file_status.st_mode))
+    {
+        size_t file_size = static_cast<size_t>(file_status.st_size);
+#if defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        // A file of a block or two is read on the caller's thread; starting
+        // a thread would cost more than the overlap saves.
+        use_io_thread = file_size > 2 * INITIAL_BLOCK_SIZE;
+        sync_buffer_size = std::clamp<size_t>(file_size, 1, INITIAL_BLOCK_SIZE);
+    }
+#else
+    stream.open(path, std::ios::binary);
+    if (!stream.is_open())
+        return;
+#endif
+    opened = true;
+
+    if (!use_io_thread)
+    {
+        block_size = sync_buffer_size;
+        buffers[0].data.reset(allocate_aligned(block_size));
+        opened = buffers[0].data != nullptr;
+        return;
+    }
+
+    for (Buffer &buffer : buffers)
+    {
+        buffer.data.reset(allocate_aligned(MAX_BLOCK_SIZE));
+        if (!buffer.data)
+        {
+            opened = false;
+            return;
+        }
+    }
+    io_thread = std::thread(&ReadAheadReader::read_ahead_loop, this);
+}
+
+ReadAheadReader::~ReadAheadReader()
+{
+    if (io_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            stopping = true;
+        }
+        buffer_released.notify_one();
+        io_thread.join();
+    }
+#if defined(GREP_HAS_POSIX_IO)
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+// Reads until length bytes arrive or the file ends. Returns 0 only at the
+// end of the file or on an error.
+size_t ReadAheadReader::read_block(char *destination, size_t length)
+{
+    size_t total = 0;
+    while (total < length)
+    {
+#if defined(GREP_HAS_POSIX_IO)
+        ssize_t received = read(fd, destination + total, length - total);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            break;
+        total += static_cast<size_t>(received);
+#else
+        stream.read(destination + total, static_cast<std::streamsize>(length - total));
+        total += static_cast<size_t>(stream.gcount());
+        if (!stream)
+            break;
+#endif
+    }
+    return total;
+}
+
+std::string_view ReadAheadReader::next_block()
+{
+    if (!opened)
+        return {};
+
+    if (!io_thread.joinable())
+    {
+        size_t length = read_block(buffers[0].data.get(), block_size);
+        return {buffers[0].data.get(), length};
+    }
+
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    if (holding_buffer)
+    {
+        holding_buffer = false;
+        next_take = (next_take + 1) % BUFFER_COUNT;
+        filled_count--;
+        buffer_released.notify_one();
+    }
+    buffer_filled.wait(lock, [&]
+                       { return filled_count > 0 || end_reached; });
+    if (filled_count == 0)
+        return {};
+    holding_buffer = true;
+    return {buffers[next_take].data.get(), buffers[next_take].length};
+}
+
+void ReadAheadReader::read_ahead_loop()
+{
+    while (true)
+    {
+        size_t fill_index;
+        {
+            std::unique_lock<std::mutex> lock(ring_mutex);
+            buffer_released.wait(lock, [&]
+                                 { return stopping || filled_count < BUFFER_COUNT; });
+            if (stopping)
+                return;
+            fill_index = next_fill;
+        }
+
+        auto read_start = std::chrono::steady_clock::now();
+        size_t length = read_block(buffers[fill_index].data.get(), block_size);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - read_start;
+
+        {
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            if (length == 0)
+                end_reached = true;
+            else
+            {
+                buffers[fill_index].length = length;
+                next_fill = (next_fill + 1) % BUFFER_COUNT;
+                filled_count++;
+            }
+        }
+        buffer_filled.notify_one();
+        if (length == 0)
+            return;
+        if (length == block_size)
+            adapt_block_size(length, elapsed.count());
+    }
+}
+
+// Doubles the block size while each doubling still raises throughput by a
+// tenth. If a doubling made things worse the previous size is restored and
+// kept for the rest of the file.
+void ReadAheadReader::adapt_block_size(size_t length, double seconds)
+{
+    if (size_settled || seconds <= 0)
+        return;
+    double throughput = static_cast<double>(length) / seconds;
+    if (previous_throughput > 0 && throughput < previous_throughput)
+    {
+        block_size /= 2;
+        size_settled = true;
+        return;
+    }
+    if (previous_throughput > 0 && throughput < previous_throughput * 1.1)
+    {
+        size_settled = true;
+        return;
+    }
+    if (block_size >= MAX_BLOCK_SIZE)
+    {
+        size_settled = true;
+        return;
+    }
+    previous_throughput = throughput;
+    block_size *= 2;
+}
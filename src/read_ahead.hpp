@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// --- Read-Ahead File Reader ---
+// Reads a file front to back in large blocks. The kernel is told the access
+// is sequential, and for files spanning several blocks a background I/O
+// thread fills a ring of page-aligned buffers while the caller searches the
+// block it was handed last. The block size starts at INITIAL_BLOCK_SIZE and
+// doubles while larger reads still raise the measured throughput, so slow
+// devices get large requests and page-cache hits stay small.
+class ReadAheadReader
+{
+public:
+    static constexpr size_t BUFFER_ALIGNMENT = 4096;
+    static constexpr size_t BUFFER_COUNT = 2;
+    static constexpr size_t INITIAL_BLOCK_SIZE = 1 << 20;
+    static constexpr size_t MAX_BLOCK_SIZE = 8 << 20;
+
+    explicit ReadAheadReader(const std::string &path);
+    ReadAheadReader(const ReadAheadReader &) = delete;
+    ReadAheadReader &operator=(const ReadAheadReader &) = delete;
+    ~ReadAheadReader();
+
+    bool is_open() const { return opened; }
+
+    // Returns the next block of the file, valid until the following call, or
+    // an empty view at the end of the file or after a read error.
+    std::string_view next_block();
+
+private:
+    struct AlignedFree
+    {
+        void operator()(char *data) const;
+    };
+    struct Buffer
+    {
+        std::unique_ptr<char, AlignedFree> data;
+        size_t length = 0;
+    };
+
+    size_t read_block(char *destination, size_t length);
+    void read_ahead_loop();
+    void adapt_block_size(size_t length, double seconds);
+
+    bool opened = false;
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = -1;
+#else
+    std::ifstream stream;
+#endif
+
+    Buffer buffers[BUFFER_COUNT];
+    size_t block_size = INITIAL_BLOCK_SIZE;
+    double previous_throughput = 0; // Bytes per second at half the current block size
+    bool size_settled = false;
+
+    // Ring state, guarded by ring_mutex when the I/O thread runs.
+    std::mutex ring_mutex;
+    std::condition_variable buffer_filled;
+    std::condition_variable buffer_released;
+    size_t next_fill = 0;
+    size_t next_take = 0;
+    size_t filled_count = 0; // Includes the buffer the caller holds
+    bool holding_buffer = false;
+    bool end_reached = false;
+    bool stopping = false;
+    std::thread io_thread;
+};
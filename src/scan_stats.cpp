@@ -0,0 +1,163 @@
+#include "scan_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define GREP_HAS_ISATTY 1
+#endif
+
+namespace
+{
+    const char *const SCAN_ENGINE_NAMES[SCAN_ENGINE_COUNT] = {"dfa", "backtracking", "literals", "token-filter"};
+
+    constexpr std::chrono::seconds TERMINAL_PROGRESS_INTERVAL{1};
+    constexpr std::chrono::seconds LOG_PROGRESS_INTERVAL{10};
+
+    template <size_t N>
+    size_t sum(const std::atomic<size_t> (&counters)[N])
+    {
+        size_t total = 0;
+        for (const std::atomic<size_t> &counter : counters)
+            total += counter.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    double mebibytes(size_t bytes)
+    {
+        return static_cast<double>(bytes) / (1 << 20);
+    }
+
+    double percent(size_t part, size_t whole)
+    {
+        return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+    }
+
+    // Appends "name share%" for every counter that saw bytes.
+    template <typename Name>
+    void append_shares(std::string &report, const std::atomic<size_t> *counters, int count, size_t total, Name name)
+    {
+        bool first = true;
+        for (int i = 0; i < count; i++)
+        {
+            size_t bytes = counters[i].load(std::memory_order_relaxed);
+            if (bytes == 0)
+                continue;
+            char share[64];
+            std::snprintf(share, sizeof(share), "%s %s %.1f%%", first ? "" : ",", name(i), percent(bytes, total));
+            report += share;
+            first = false;
+        }
+        if (first)
+            report += " none";
+    }
+}
+
+const char *scan_engine_name(ScanEngine engine)
+{
+    return SCAN_ENGINE_NAMES[engine];
+}
+
+size_t ScanStats::bytes_read() const
+{
+    return sum(bytes_by_backend);
+}
+
+size_t ScanStats::bytes_scanned() const
+{
+    return sum(bytes_by_engine);
+}
+
+std::string format_scan_stats(const ScanStats &stats, double elapsed_seconds)
+{
+    size_t bytes_read = stats.bytes_read();
+    size_t engine_bytes = stats.bytes_scanned();
+
+    double read_mebibytes = mebibytes(bytes_read);
+    char summary[256];
+    std::snprintf(summary, sizeof(summary), "Stats: %zu files searched, %zu skipped, %.1f MiB read in %.3f s (%.1f MiB/s), %zu lines matched;",
+                  stats.files_searched.load(std::memory_order_relaxed), stats.files_skipped.load(std::memory_order_relaxed),
+                  read_mebibytes, elapsed_seconds, elapsed_seconds > 0 ? read_mebibytes / elapsed_seconds : 0.0,
+                  stats.matched_lines.load(std::memory_order_relaxed));
+    std::string report = summary;
+
+    report += " engine";
+    append_shares(report, stats.bytes_by_engine, SCAN_ENGINE_COUNT, engine_bytes, [](int i)
+                  { return scan_engine_name(static_cast<ScanEngine>(i)); });
+    char prefilter[64];
+    std::snprintf(prefilter, sizeof(prefilter), ", prefilter skipped %.1f%%;",
+                  percent(stats.prefilter_skipped_bytes.load(std::memory_order_relaxed), engine_bytes));
+    report += prefilter;
+
+    report += " io";
+    append_shares(report, stats.bytes_by_backend, INPUT_BACKEND_COUNT, bytes_read, [](int i)
+                  { return input_backend_name(static_cast<InputBackend>(i)); });
+    return report;
+}
+
+ProgressReporter::ProgressReporter(const ScanStats &stats) : stats(stats)
+{
+#if defined(GREP_HAS_ISATTY)
+    redraw_in_place = isatty(STDERR_FILENO) != 0;
+#endif
+    reporter = std::thread([this]
+                           { run(); });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_condition.notify_one();
+    reporter.join();
+    if (redraw_in_place)
+        std::fputs("\r\033[K", stderr);
+}
+
+void ProgressReporter::run()
+{
+    using Clock = std::chrono::steady_clock;
+    const std::chrono::seconds interval = redraw_in_place ? TERMINAL_PROGRESS_INTERVAL : LOG_PROGRESS_INTERVAL;
+    const Clock::time_point started = Clock::now();
+    Clock::time_point last_report = started;
+    size_t last_scanned = 0;
+
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!stop_condition.wait_for(lock, interval, [this]
+                                    { return stopping; }))
+    {
+        Clock::time_point now = Clock::now();
+        size_t scanned = stats.bytes_scanned();
+        size_t discovered = std::max(stats.bytes_discovered.load(std::memory_order_relaxed), scanned);
+        double interval_seconds = std::chrono::duration<double>(now - last_report).count();
+        double elapsed_seconds = std::chrono::duration<double>(now - started).count();
+        double current_rate = interval_seconds > 0 ? mebibytes(scanned - last_scanned) / interval_seconds : 0.0;
+        last_report = now;
+        last_scanned = scanned;
+
+        char report[256];
+        int length = std::snprintf(report, sizeof(report), "Progress: %.1f MiB", mebibytes(scanned));
+        size_t files_discovered = stats.files_discovered.load(std::memory_order_relaxed);
+        if (files_discovered > 0)
+            length += std::snprintf(report + length, sizeof(report) - length, " of %.1f MiB (%.1f%%), %zu of %zu files",
+                                    mebibytes(discovered), discovered ? 100.0 * scanned / discovered : 100.0,
+                                    stats.files_done.load(std::memory_order_relaxed), files_discovered);
+        length += std::snprintf(report + length, sizeof(report) - length, ", %.1f MiB/s", current_rate);
+
+        // The ETA uses the average rate so far, which a slow or fast
+        // interval moves less than the current one.
+        if (files_discovered > 0 && scanned > 0 && elapsed_seconds > 0)
+        {
+            long long remaining = static_cast<long long>((discovered - scanned) * elapsed_seconds / scanned);
+            std::snprintf(report + length, sizeof(report) - length, ", ETA %lld:%02lld:%02lld",
+                          remaining / 3600, remaining / 60 % 60, remaining % 60);
+        }
+        // Written through stdio, which unlike the unsynchronized std::cerr
+        // may be shared with the workers' warnings.
+        std::fprintf(stderr, redraw_in_place ? "\r\033[K%s" : "%s\n", report);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "input_source.hpp"
+
+// --- Scan Statistics (--stats) ---
+// Totals for the one-line report after a scan. Workers add to them with
+// relaxed atomics once per block or per file, never per byte; without
+// --stats the search is handed no ScanStats and counts nothing.
+enum ScanEngine
+{
+    SCAN_ENGINE_DFA = 0,
+    SCAN_ENGINE_BACKTRACKING,
+    SCAN_ENGINE_LITERALS,
+    SCAN_ENGINE_TOKEN_FILTER,
+    SCAN_ENGINE_COUNT
+};
+
+const char *scan_engine_name(ScanEngine engine);
+
+struct ScanStats
+{
+    std::atomic<size_t> files_searched{0};
+    std::atomic<size_t> files_skipped{0}; // Could not be opened, or --timeout expired first
+    std::atomic<size_t> matched_lines{0};
+    std::atomic<size_t> bytes_by_backend[INPUT_BACKEND_COUNT] = {};
+    std::atomic<size_t> bytes_by_engine[SCAN_ENGINE_COUNT] = {};
+    std::atomic<size_t> prefilter_skipped_bytes{0}; // Part of the engine bytes that a skip loop passed over
+    std::atomic<size_t> files_done{0};
+    std::atomic<size_t> files_discovered{0}; // Regular files found by traversal, for --progress
+    std::atomic<size_t> bytes_discovered{0};
+
+    static void add(std::atomic<size_t> &counter, size_t amount) { counter.fetch_add(amount, std::memory_order_relaxed); }
+
+    size_t bytes_read() const;
+    size_t bytes_scanned() const; // Bytes that have been through an engine
+};
+
+// Formats the report, e.g. "Stats: 3 files searched, 0 skipped, 24.0 MiB read
+// in 0.051 s (470.6 MiB/s), 12 lines matched; engine dfa 100.0%, prefilter
+// skipped 97.5%; io mmap 99.9%, pread 0.1%".
+std::string format_scan_stats(const ScanStats &stats, double elapsed_seconds);
+
+// --- Progress Reports (--progress) ---
+// A timer thread that prints bytes scanned, files done, the throughput over
+// the last interval and an ETA from the sizes traversal has discovered so
+// far. It only reads the ScanStats counters, so workers never wait for it.
+// On a terminal the report is redrawn in place every second; otherwise a
+// line is written every ten seconds.
+class ProgressReporter
+{
+public:
+    explicit ProgressReporter(const ScanStats &stats);
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+    ~ProgressReporter(); // Stops the thread and clears a report drawn in place
+
+private:
+    void run();
+
+    const ScanStats &stats;
+    bool redraw_in_place = false;
+    std::mutex stop_mutex;
+    std::condition_variable stop_condition;
+    bool stopping = false;
+    std::thread reporter;
+};
@@ -0,0 +1,196 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    thread_local int worker_index_of_thread = -1;
+}
+
+// --- WorkStealingDeque ---
+WorkStealingDeque::Ring::Ring(int64_t ring_capacity)
+    : capacity(ring_capacity), slots(new std::atomic<PoolTask *>[ring_capacity])
+{
+}
+
+WorkStealingDeque::WorkStealingDeque()
+{
+    rings.push_back(std::make_unique<Ring>(INITIAL_CAPACITY));
+    ring.store(rings.back().get(), std::memory_order_relaxed);
+}
+
+void WorkStealingDeque::push(PoolTask *task)
+{
+    int64_t current_bottom = bottom.load(std::memory_order_relaxed);
+    int64_t current_top = top.load(std::memory_order_acquire);
+    Ring *current_ring = ring.load(std::memory_order_relaxed);
+    if (current_bottom - current_top > current_ring->capacity - 1)
+    {
+        auto grown_ring = std::make_unique<Ring>(current_ring->capacity * 2);
+        for (int64_t index = current_top; index < current_bottom; ++index)
+            grown_ring->put(index, current_ring->get(index));
+        current_ring = grown_ring.get();
+        rings.push_back(std::move(grown_ring));
+        ring.store(current_ring, std::memory_order_release);
+    }
+    current_ring->put(current_bottom, task);
+    bottom.store(current_bottom + 1, std::memory_order_release);
+}
+
+PoolTask *WorkStealingDeque::pop()
+{
+    int64_t current_bottom = bottom.load(std::memory_order_relaxed) - 1;
+    Ring *current_ring = ring.load(std::memory_order_relaxed);
+    bottom.store(current_bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t current_top = top.load(std::memory_order_relaxed);
+
+    if (current_top > current_bottom)
+    {
+        bottom.store(current_bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    PoolTask *task = current_ring->get(current_bottom);
+    if (current_top == current_bottom)
+    {
+        // Last task: race thieves for it.
+        if (!top.compare_exchange_strong(current_top, current_top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = nullptr;
+        bottom.store(current_bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+PoolTask *WorkStealingDeque::steal()
+{
+    int64_t current_top = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t current_bottom = bottom.load(std::memory_order_acquire);
+    if (current_top >= current_bottom)
+        return nullptr;
+
+    PoolTask *task = ring.load(std::memory_order_acquire)->get(current_top);
+    if (!top.compare_exchange_strong(current_top, current_top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return task;
+}
+
+// --- ThreadPool ---
+ThreadPool::ThreadPool(size_t worker_count)
+{
+    for (size_t index = 0; index < std::max<size_t>(1, worker_count); ++index)
+        workers.push_back(std::make_unique<Worker>());
+    for (size_t index = 0; index < workers.size(); ++index)
+        workers[index]->thread = std::thread(&ThreadPool::worker_loop, this, index);
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_condition.notify_all();
+    for (auto &worker : workers)
+        worker->thread.join();
+}
+
+int ThreadPool::current_worker_index()
+{
+    return worker_index_of_thread;
+}
+
+void ThreadPool::submit(TaskPriority priority, std::function<void()> run, CancellationToken token)
+{
+    PoolTask *task = new PoolTask{std::move(run), std::move(token)};
+    unfinished_tasks.fetch_add(1, std::memory_order_relaxed);
+    queued_tasks.fetch_add(1, std::memory_order_release);
+
+    int worker_index = worker_index_of_thread;
+    if (worker_index >= 0)
+    {
+        workers[worker_index]->deques[priority].push(task);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(injection_mutex);
+        injection_queues[priority].push_back(task);
+    }
+
+    // Notify under the sleep mutex so a worker that has just found nothing
+    // cannot miss the wakeup between its check and its wait.
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake_condition.notify_one();
+}
+
+void ThreadPool::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    idle_condition.wait(lock, [&]
+                        { return unfinished_tasks.load(std::memory_order_acquire) == 0; });
+}
+
+PoolTask *ThreadPool::find_task(size_t worker_index)
+{
+    for (int priority = 0; priority < PRIORITY_COUNT; ++priority)
+    {
+        if (PoolTask *task = workers[worker_index]->deques[priority].pop())
+            return task;
+        {
+            std::lock_guard<std::mutex> lock(injection_mutex);
+            if (!injection_queues[priority].empty())
+            {
+                PoolTask *task = injection_queues[priority].front();
+                injection_queues[priority].pop_front();
+                return task;
+            }
+        }
+        for (size_t offset = 1; offset < workers.size(); ++offset)
+        {
+            size_t victim = (worker_index + offset) % workers.size();
+            if (PoolTask *task = workers[victim]->deques[priority].steal())
+                return task;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::worker_loop(size_t worker_index)
+{
+    worker_index_of_thread = static_cast<int>(worker_index);
+    while (true)
+    {
+        PoolTask *task = find_task(worker_index);
+        if (!task)
+        {
+            // A task may be counted but not pushed yet, or a steal may have
+            // lost a race; only sleep once nothing is left.
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (queued_tasks.load(std::memory_order_acquire) > 0)
+            {
+                lock.unlock();
+                std::this_thread::yield();
+                continue;
+            }
+            wake_condition.wait(lock, [&]
+                                { return stopping || queued_tasks.load(std::memory_order_acquire) > 0; });
+            if (stopping)
+                return;
+            continue;
+        }
+
+        queued_tasks.fetch_sub(1, std::memory_order_relaxed);
+        if (!task->token.is_cancelled())
+            task->run();
+        delete task;
+
+        if (unfinished_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            idle_condition.notify_all();
+        }
+    }
+}
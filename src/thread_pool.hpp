@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --- Work-Stealing Thread Pool ---
+// One pool is shared by every parallel stage (directory traversal, file
+// matching, output) so CPU use stays bounded by --threads. Each worker owns a
+// Chase-Lev deque per priority: it pushes and pops its own tasks LIFO at the
+// bottom while idle workers steal FIFO from the top. Workers always drain
+// higher priorities first, so traversal keeps the pool fed before matching
+// starts and output flushes come last. Deferred matching (cold files under
+// --cache-first) waits for all other matching.
+enum TaskPriority
+{
+    PRIORITY_TRAVERSAL = 0,
+    PRIORITY_MATCHING,
+    PRIORITY_DEFERRED_MATCHING,
+    PRIORITY_OUTPUT,
+    PRIORITY_COUNT
+};
+
+// Shared flag for abandoning a group of tasks, made by create(). Tasks whose
+// token is cancelled are dropped unrun; long-running tasks may poll it
+// themselves. A default token holds no flag and can never be cancelled, so
+// the many tasks submitted without one, such as every coroutine reschedule,
+// cost no allocation.
+class CancellationToken
+{
+public:
+    static CancellationToken create()
+    {
+        CancellationToken token;
+        token.cancelled = std::make_shared<std::atomic<bool>>(false);
+        return token;
+    }
+
+    void cancel()
+    {
+        if (cancelled)
+            cancelled->store(true, std::memory_order_relaxed);
+    }
+    bool is_cancelled() const { return cancelled && cancelled->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled; // Null for a token that cannot be cancelled
+};
+
+struct PoolTask
+{
+    std::function<void()> run;
+    CancellationToken token;
+};
+
+// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models"). Only the owning worker calls push and pop; any thread may
+// steal. Replaced rings are kept until destruction because a thief may still
+// be reading one.
+class WorkStealingDeque
+{
+public:
+    WorkStealingDeque();
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    void push(PoolTask *task);
+    PoolTask *pop();
+    PoolTask *steal();
+
+private:
+    struct Ring
+    {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<PoolTask *>[]> slots;
+
+        explicit Ring(int64_t ring_capacity);
+        PoolTask *get(int64_t index) const { return slots[index & (capacity - 1)].load(std::memory_order_acquire); }
+        void put(int64_t index, PoolTask *task) { slots[index & (capacity - 1)].store(task, std::memory_order_release); }
+    };
+
+    static constexpr int64_t INITIAL_CAPACITY = 64;
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Ring *> ring;
+    std::vector<std::unique_ptr<Ring>> rings; // Current ring is rings.back()
+};
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t worker_count);
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    // Queues run at priority. From a worker the task goes to that worker's
+    // own deque; from any other thread it goes to the shared injection queue.
+    void submit(TaskPriority priority, std::function<void()> run, CancellationToken token = {});
+
+    // co_await pool.schedule(priority) suspends the calling coroutine and
+    // resumes it as a task of that priority on one of the workers.
+    struct ScheduleAwaiter
+    {
+        ThreadPool &pool;
+        TaskPriority priority;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            pool.submit(priority, [handle]
+                        { handle.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+    ScheduleAwaiter schedule(TaskPriority priority) { return {*this, priority}; }
+
+    // Blocks until every submitted task, including tasks submitted by tasks,
+    // has finished or been dropped.
+    void wait_idle();
+
+    size_t worker_count() const { return workers.size(); }
+
+    // Index of the calling worker in [0, worker_count()), or -1 when called
+    // from a thread outside the pool.
+    static int current_worker_index();
+
+private:
+    struct Worker
+    {
+        WorkStealingDeque deques[PRIORITY_COUNT];
+        std::thread thread;
+    };
+
+    void worker_loop(size_t worker_index);
+    PoolTask *find_task(size_t worker_index);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex injection_mutex;
+    std::deque<PoolTask *> injection_queues[PRIORITY_COUNT];
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_condition;
+    std::condition_variable idle_condition;
+    std::atomic<size_t> queued_tasks{0};     // Submitted but not yet taken by a worker
+    std::atomic<size_t> unfinished_tasks{0}; // Submitted but not yet finished
+    bool stopping = false;
+};
+
+// Return type of coroutines that nobody awaits. The coroutine starts on the
+// calling thread, normally moves itself onto a pool with co_await
+// pool.schedule(...), and frees its frame when it finishes.
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
@@ -0,0 +1,182 @@
+#include "time_range.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+const char *const DEFAULT_TIMESTAMP_FORMAT = "%Y-%m-%d %H:%M:%S";
+
+namespace
+{
+    const char *const MONTH_NAMES[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Reads one field at position; false if text does not hold it there.
+    bool parse_field(int field, std::string_view text, size_t &position, int &value)
+    {
+        std::string_view rest = text.substr(position);
+        if (field == TIMESTAMP_MONTH && !rest.empty() && !is_digit(rest[0]) && rest[0] != ' ')
+        {
+            for (int month = 0; month < 12; month++)
+            {
+                if (rest.substr(0, 3) == MONTH_NAMES[month])
+                {
+                    value = month + 1;
+                    position += 3;
+                    return true;
+                }
+            }
+            return false;
+        }
+        size_t width = field == TIMESTAMP_YEAR ? 4 : 2;
+        if (rest.size() < width)
+            return false;
+        value = 0;
+        for (size_t i = 0; i < width; i++)
+        {
+            if (is_digit(rest[i]))
+                value = value * 10 + (rest[i] - '0');
+            else if (!(rest[i] == ' ' && i + 1 < width && value == 0))
+                return false;
+        }
+        position += width;
+        return true;
+    }
+
+    // The first line start at or after position whose line begins with a
+    // timestamp, or npos.
+    size_t next_stamped_line(std::string_view text, size_t position, const TimestampFormat &format, Timestamp &timestamp)
+    {
+        if (position > 0)
+        {
+            size_t newline = text.find('\n', position - 1);
+            position = newline == std::string_view::npos ? text.size() : newline + 1;
+        }
+        while (position < text.size())
+        {
+            if (parse_timestamp(format, text.substr(position), timestamp))
+                return position;
+            size_t newline = text.find('\n', position);
+            if (newline == std::string_view::npos)
+                break;
+            position = newline + 1;
+        }
+        return std::string_view::npos;
+    }
+
+    // The first stamped line for which reached(timestamp) holds, or the end
+    // of text. reached must turn true once and stay true along the file.
+    template <typename Predicate>
+    size_t first_stamped_line(std::string_view text, const TimestampFormat &format, Predicate reached)
+    {
+        size_t low = 0;
+        size_t high = text.size();
+        Timestamp timestamp;
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            size_t line = next_stamped_line(text, middle, format, timestamp);
+            if (line == std::string_view::npos || reached(timestamp))
+                high = middle;
+            else
+                low = middle + 1;
+        }
+        size_t line = next_stamped_line(text, low, format, timestamp);
+        return line == std::string_view::npos ? text.size() : line;
+    }
+}
+
+TimestampFormat parse_timestamp_format(std::string_view format)
+{
+    TimestampFormat parsed;
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] != '%')
+        {
+            parsed.items.push_back({-1, format[i]});
+            continue;
+        }
+        if (++i == format.size())
+            throw std::runtime_error("timestamp format ends with %");
+        switch (format[i])
+        {
+        case 'Y':
+            parsed.items.push_back({TIMESTAMP_YEAR, 0});
+            break;
+        case 'm':
+        case 'b':
+            parsed.items.push_back({TIMESTAMP_MONTH, 0});
+            break;
+        case 'd':
+            parsed.items.push_back({TIMESTAMP_DAY, 0});
+            break;
+        case 'H':
+            parsed.items.push_back({TIMESTAMP_HOUR, 0});
+            break;
+        case 'M':
+            parsed.items.push_back({TIMESTAMP_MINUTE, 0});
+            break;
+        case 'S':
+            parsed.items.push_back({TIMESTAMP_SECOND, 0});
+            break;
+        case '%':
+            parsed.items.push_back({-1, '%'});
+            break;
+        default:
+            throw std::runtime_error(std::string("unsupported timestamp directive %") + format[i]);
+        }
+    }
+    return parsed;
+}
+
+bool parse_timestamp(const TimestampFormat &format, std::string_view text, Timestamp &timestamp, bool partial)
+{
+    timestamp.present = 0;
+    size_t position = 0;
+    for (const TimestampFormat::Item &item : format.items)
+    {
+        if (partial && position == text.size())
+            break;
+        if (item.field < 0)
+        {
+            if (position == text.size() || text[position] != item.literal)
+                return false;
+            position++;
+        }
+        else
+        {
+            if (!parse_field(item.field, text, position, timestamp.fields[item.field]))
+                return false;
+            timestamp.present |= 1u << item.field;
+        }
+    }
+    return timestamp.present != 0 && (!partial || position == text.size());
+}
+
+int compare_timestamps(const Timestamp &line, const Timestamp &bound)
+{
+    for (int field = 0; field < TIMESTAMP_FIELD_COUNT; field++)
+    {
+        if (!(line.present & bound.present & (1u << field)))
+            continue;
+        if (line.fields[field] != bound.fields[field])
+            return line.fields[field] < bound.fields[field] ? -1 : 1;
+    }
+    return 0;
+}
+
+std::pair<size_t, size_t> find_time_range(std::string_view text, const TimeRange &range)
+{
+    size_t begin = 0;
+    size_t end = text.size();
+    if (range.has_since)
+        begin = first_stamped_line(text, range.format, [&](const Timestamp &timestamp)
+                                   { return compare_timestamps(timestamp, range.since) >= 0; });
+    if (range.has_until)
+        end = first_stamped_line(text, range.format, [&](const Timestamp &timestamp)
+                                 { return compare_timestamps(timestamp, range.until) > 0; });
+    return {begin, std::max(begin, end)};
+}
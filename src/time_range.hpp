@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// --- Timestamp Ranges (--since, --until) ---
+// Log files are written in time order, so the lines between two times form
+// one byte range that a binary search over the file can find: each probe
+// moves to the next line start and reads the timestamp the line begins
+// with. Lines without one (continuation lines, stack traces) belong to the
+// timestamped line before them.
+//
+// Formats take strftime-style directives: %Y (four digits), %m, %d, %H, %M,
+// %S (two digits, or a space and one digit as syslog pads days), %b (Jan to
+// Dec) and %%; other characters must match exactly.
+enum TimestampField
+{
+    TIMESTAMP_YEAR = 0,
+    TIMESTAMP_MONTH,
+    TIMESTAMP_DAY,
+    TIMESTAMP_HOUR,
+    TIMESTAMP_MINUTE,
+    TIMESTAMP_SECOND,
+    TIMESTAMP_FIELD_COUNT
+};
+
+struct TimestampFormat
+{
+    struct Item
+    {
+        int field = -1; // A TimestampField, or -1 for a literal
+        char literal = 0;
+    };
+    std::vector<Item> items;
+};
+
+extern const char *const DEFAULT_TIMESTAMP_FORMAT;
+
+struct Timestamp
+{
+    int fields[TIMESTAMP_FIELD_COUNT] = {};
+    unsigned present = 0; // Bit per TimestampField that was parsed
+};
+
+// Throws std::runtime_error for an unknown directive.
+TimestampFormat parse_timestamp_format(std::string_view format);
+
+// Parses the timestamp text begins with. With partial, text may stop after
+// any field and must hold nothing else, as --since and --until values do.
+bool parse_timestamp(const TimestampFormat &format, std::string_view text, Timestamp &timestamp, bool partial = false);
+
+// Compares the fields both timestamps have, most significant first, so a
+// bound given to the minute covers every second of that minute.
+int compare_timestamps(const Timestamp &line, const Timestamp &bound);
+
+struct TimeRange
+{
+    TimestampFormat format;
+    Timestamp since;
+    Timestamp until;
+    bool has_since = false;
+    bool has_until = false;
+};
+
+// The byte range of the lines of text from the first stamped at or after
+// since up to, not including, the first stamped after until. text must be
+// sorted by timestamp.
+std::pair<size_t, size_t> find_time_range(std::string_view text, const TimeRange &range);
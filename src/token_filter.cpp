@@ -0,0 +1,225 @@
+#include "token_filter.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GREP_HAS_MMAP 1
+#endif
+
+const char *const DEFAULT_TOKEN_DELIMITERS = " \t\r,;\"'()[]{}<>=|&";
+
+namespace
+{
+    // File layout (native byte order, all fields 8-byte aligned):
+    //   header | blocks[block_count * WORDS_PER_BLOCK] | offsets[literal_count + 1] | literal bytes
+    struct TokenFilterHeader
+    {
+        char magic[8];
+        uint64_t byte_order_mark;
+        uint64_t block_count;
+        uint64_t literal_count;
+        uint64_t literal_bytes;
+    };
+
+    constexpr char FILTER_MAGIC[8] = {'G', 'R', 'E', 'P', 'T', 'K', 'F', '2'};
+    constexpr uint64_t BYTE_ORDER_MARK = 0x0102030405060708ull;
+
+    uint64_t mix_hash(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    }
+
+    uint64_t hash_token(std::string_view token)
+    {
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ (token.size() * 0xff51afd7ed558ccdull);
+        size_t offset = 0;
+        for (; offset + 8 <= token.size(); offset += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, token.data() + offset, 8);
+            hash = mix_hash(hash ^ word);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, token.data() + offset, token.size() - offset);
+        return mix_hash(hash ^ tail ^ (static_cast<uint64_t>(token.size() - offset) << 56));
+    }
+
+    // Split-block Bloom filter: the high half of the hash picks a block and
+    // the low half, multiplied by a different odd salt per word, sets one bit
+    // in each of its eight words, so no hash bit serves both purposes.
+    constexpr uint32_t WORD_SALTS[TokenFilter::WORDS_PER_BLOCK] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                                                                  0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+    uint64_t block_index(uint64_t hash, uint64_t block_count)
+    {
+        return (hash >> 32) % block_count;
+    }
+
+    uint64_t word_bit(uint64_t hash, uint32_t word)
+    {
+        uint32_t salted = static_cast<uint32_t>(hash) * WORD_SALTS[word];
+        return 1ull << (salted >> 26);
+    }
+
+    std::string_view literal_at(const TokenFilter &filter, uint64_t index)
+    {
+        return {filter.literal_data + filter.literal_offsets[index],
+                static_cast<size_t>(filter.literal_offsets[index + 1] - filter.literal_offsets[index])};
+    }
+}
+
+TokenFilter::~TokenFilter()
+{
+#if defined(GREP_HAS_MMAP)
+    if (is_mapped)
+        munmap(const_cast<unsigned char *>(file_data), file_size);
+#endif
+}
+
+bool TokenFilter::may_contain(std::string_view token) const
+{
+    uint64_t hash = hash_token(token);
+    const uint64_t *block = blocks + block_index(hash, block_count) * WORDS_PER_BLOCK;
+    for (uint32_t word = 0; word < WORDS_PER_BLOCK; ++word)
+    {
+        if (!(block[word] & word_bit(hash, word)))
+            return false;
+    }
+    return true;
+}
+
+uint64_t TokenFilter::find(std::string_view token) const
+{
+    if (!may_contain(token))
+        return literal_count;
+
+    uint64_t low = 0;
+    uint64_t high = literal_count;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        if (literal_at(*this, middle) < token)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < literal_count && literal_at(*this, low) == token ? low : literal_count;
+}
+
+TokenDelimiters make_token_delimiters(std::string_view delimiter_chars)
+{
+    TokenDelimiters delimiters{};
+    for (char delimiter : delimiter_chars)
+        delimiters[static_cast<unsigned char>(delimiter)] = true;
+    delimiters['\n'] = true;
+    return delimiters;
+}
+
+size_t write_token_filter(const std::string &path, std::vector<std::string> literals, const TokenDelimiters &delimiters)
+{
+    std::sort(literals.begin(), literals.end());
+    literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+
+    size_t unmatchable_count = 0;
+    for (const std::string &literal : literals)
+    {
+        bool has_delimiter = literal.empty() || std::any_of(literal.begin(), literal.end(), [&](char literal_char)
+                                                            { return delimiters[static_cast<unsigned char>(literal_char)]; });
+        if (has_delimiter)
+            unmatchable_count++;
+    }
+
+    TokenFilterHeader header{};
+    std::memcpy(header.magic, FILTER_MAGIC, sizeof(FILTER_MAGIC));
+    header.byte_order_mark = BYTE_ORDER_MARK;
+    uint64_t bits_per_block = TokenFilter::WORDS_PER_BLOCK * 64;
+    header.block_count = std::max<uint64_t>(1, (literals.size() * TokenFilter::BITS_PER_LITERAL + bits_per_block - 1) / bits_per_block);
+    header.literal_count = literals.size();
+
+    std::vector<uint64_t> blocks(header.block_count * TokenFilter::WORDS_PER_BLOCK, 0);
+    std::vector<uint64_t> offsets;
+    offsets.reserve(literals.size() + 1);
+    offsets.push_back(0);
+    for (const std::string &literal : literals)
+    {
+        uint64_t hash = hash_token(literal);
+        uint64_t *block = &blocks[block_index(hash, header.block_count) * TokenFilter::WORDS_PER_BLOCK];
+        for (uint32_t word = 0; word < TokenFilter::WORDS_PER_BLOCK; ++word)
+            block[word] |= word_bit(hash, word);
+        offsets.push_back(offsets.back() + literal.size());
+    }
+    header.literal_bytes = offsets.back();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        throw std::runtime_error("cannot create token filter " + path);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(blocks.data()), blocks.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    for (const std::string &literal : literals)
+        out.write(literal.data(), literal.size());
+    if (!out.good())
+        throw std::runtime_error("failed writing token filter " + path);
+
+    return unmatchable_count;
+}
+
+void load_token_filter(const std::string &path, TokenFilter &filter)
+{
+#if defined(GREP_HAS_MMAP)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("cannot open token filter " + path);
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0 || file_status.st_size < static_cast<off_t>(sizeof(TokenFilterHeader)))
+    {
+        close(fd);
+        throw std::runtime_error("not a token filter: " + path);
+    }
+    void *mapping = mmap(nullptr, static_cast<size_t>(file_status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("cannot map token filter " + path);
+    filter.file_data = static_cast<const unsigned char *>(mapping);
+    filter.file_size = static_cast<size_t>(file_status.st_size);
+    filter.is_mapped = true;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        throw std::runtime_error("cannot open token filter " + path);
+    filter.file_copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    filter.file_data = filter.file_copy.data();
+    filter.file_size = filter.file_copy.size();
+#endif
+
+    TokenFilterHeader header;
+    if (filter.file_size < sizeof(header))
+        throw std::runtime_error("not a token filter: " + path);
+    std::memcpy(&header, filter.file_data, sizeof(header));
+    if (std::memcmp(header.magic, FILTER_MAGIC, sizeof(FILTER_MAGIC)) != 0 || header.byte_order_mark != BYTE_ORDER_MARK || header.block_count == 0)
+        throw std::runtime_error("not a token filter (or built by another version or architecture): " + path);
+
+    uint64_t block_words = header.block_count * TokenFilter::WORDS_PER_BLOCK;
+    uint64_t expected_size = sizeof(header) + (block_words + header.literal_count + 1) * sizeof(uint64_t) + header.literal_bytes;
+    if (filter.file_size != expected_size)
+        throw std::runtime_error("truncated token filter " + path);
+
+    filter.blocks = reinterpret_cast<const uint64_t *>(filter.file_data + sizeof(header));
+    filter.block_count = header.block_count;
+    filter.literal_offsets = filter.blocks + block_words;
+    filter.literal_count = header.literal_count;
+    filter.literal_data = reinterpret_cast<const char *>(filter.literal_offsets + header.literal_count + 1);
+}
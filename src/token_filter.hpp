@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- Token Filter (--token-filter) ---
+// Membership test for very large literal sets (millions of ids or addresses)
+// matched as whole tokens. A split-block Bloom filter answers most lookups
+// with a single cache line; tokens that pass it are verified exactly by
+// binary search over the sorted literals. Both live in one file that is
+// built once with --build-token-filter and memory-mapped by later searches.
+struct TokenFilter
+{
+    static constexpr uint32_t WORDS_PER_BLOCK = 8; // One 64-byte cache line
+    static constexpr uint32_t BITS_PER_LITERAL = 12;
+
+    const unsigned char *file_data = nullptr;
+    size_t file_size = 0;
+    bool is_mapped = false;
+    std::vector<unsigned char> file_copy; // Used where mmap is unavailable
+
+    const uint64_t *blocks = nullptr;
+    uint64_t block_count = 0;
+    const uint64_t *literal_offsets = nullptr; // literal_count + 1 entries into literal_data
+    const char *literal_data = nullptr;
+    uint64_t literal_count = 0;
+
+    TokenFilter() = default;
+    TokenFilter(const TokenFilter &) = delete;
+    TokenFilter &operator=(const TokenFilter &) = delete;
+    ~TokenFilter();
+
+    bool may_contain(std::string_view token) const;
+    bool contains(std::string_view token) const { return find(token) < literal_count; }
+
+    // Index of token among the sorted literals, or literal_count if absent.
+    uint64_t find(std::string_view token) const;
+};
+
+// Bytes that separate tokens; '\n' always does.
+using TokenDelimiters = std::array<bool, 256>;
+
+TokenDelimiters make_token_delimiters(std::string_view delimiter_chars);
+extern const char *const DEFAULT_TOKEN_DELIMITERS;
+
+// Builds a filter file for literals. Throws std::runtime_error on I/O errors.
+// Returns the number of literals that contain a delimiter and so can never
+// match a token.
+size_t write_token_filter(const std::string &path, std::vector<std::string> literals, const TokenDelimiters &delimiters);
+
+// Maps a filter file built by write_token_filter. Throws std::runtime_error
+// if it cannot be read or is not a valid filter file.
+void load_token_filter(const std::string &path, TokenFilter &filter);
+
+// Calls on_token(start, end) for every token of text found in the filter.
+template <typename TokenCallback>
+void for_each_filtered_token(const TokenFilter &filter, const TokenDelimiters &delimiters, std::string_view text, TokenCallback &&on_token)
+{
+    size_t position = 0;
+    while (position < text.size())
+    {
+        while (position < text.size() && delimiters[static_cast<unsigned char>(text[position])])
+            ++position;
+        size_t token_start = position;
+        while (position < text.size() && !delimiters[static_cast<unsigned char>(text[position])])
+            ++position;
+        if (position > token_start && filter.contains(text.substr(token_start, position - token_start)))
+            on_token(token_start, position);
+    }
+}